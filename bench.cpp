@@ -0,0 +1,369 @@
+/// \file bench.cpp
+/// \brief PetriBench main function.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petricalc.h" //main PetriNet library
+#include "petrigen.h" //synthetic nets for gen: specifications
+#include <iostream> //for std::cerr
+#include <string> //for std::string
+#include <vector>
+#include <map>
+#include <algorithm> //for std::sort
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h> //for strtoull()
+#include <string.h>
+#include <time.h> //for clock_gettime()
+#include <unistd.h> //for fork(), pipe()
+#include <sys/wait.h> //for wait4()
+#include <sys/resource.h> //for struct rusage
+
+/// \brief Returns a monotonic timestamp in seconds.
+static double now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// \brief Splits a comma-separated list.
+static std::vector<std::string> splitList(std::string list){
+  std::vector<std::string> result;
+  std::stringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')){
+    if (item.size()){result.push_back(item);}
+  }
+  return result;
+}
+
+/// \brief Measurements of a single benchmark trial.
+struct BenchTrial{
+  double loadTime; ///< Seconds spent parsing the net.
+  double compileTime; ///< Seconds spent in PetriNet::compile.
+  double runTime; ///< Seconds spent in the measured steps, including output.
+  unsigned long long steps; ///< Measured steps, excluding warm-up.
+  unsigned long long outputBytes; ///< Bytes of state output written during the measured steps.
+  long peakRSS; ///< Peak resident set size of the trial process, in KiB.
+  bool ok; ///< False if the trial process failed.
+};
+
+/// \brief Settings shared by all trials.
+struct BenchSettings{
+  unsigned long long warmup; ///< Steps run before measuring.
+  unsigned long long steps; ///< Maximum amount of measured steps.
+  double maxSeconds; ///< Maximum duration of the measured steps.
+  unsigned int printInterval; ///< Print the state every this many steps.
+  unsigned long long seed; ///< Seed of the first trial, following trials use the next seeds.
+  unsigned int timeout; ///< Seconds after which a trial is killed.
+  int isa; ///< Instruction set limit for SIMD engines, 0 for the best available.
+  unsigned int threads; ///< Scan threads for compiled engines.
+  int split; ///< How compiled engines split maximal steps over threads.
+};
+
+/// \brief Runs a single trial in a child process, so that peak memory and any crash are isolated from other trials.
+static BenchTrial runTrial(std::string netFile, int stepMode, int engine, unsigned int trial, BenchSettings & S){
+  BenchTrial R;
+  memset(&R, 0, sizeof(R));
+  int fds[2];
+  if (pipe(fds)){return R;}
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0){
+    close(fds[0]);
+    close(fds[1]);
+    return R;
+  }
+  if (!pid){
+    close(fds[0]);
+    //State output is measured in bytes, but not kept
+    if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr)){_exit(1);}
+    //Trials that do not finish in time are killed and counted as failed
+    alarm(S.timeout);
+    std::map<std::string, unsigned int> cellnames;
+    double start = now();
+    PetriNet Net(netFile);
+    R.loadTime = now() - start;
+    start = now();
+    Net.compile(engine, S.isa, S.threads, S.split);
+    R.compileTime = now() - start;
+    Net.seed(S.seed + trial);
+    bool alive = true;
+    for (unsigned long long i = 0; alive && i < S.warmup; ++i){alive = Net.calculateStep(stepMode);}
+    start = now();
+    double end = start;
+    while (alive && R.steps < S.steps){
+      alive = Net.calculateStep(stepMode);
+      if (!alive){break;}
+      R.steps++;
+      if (R.steps % S.printInterval == 0){R.outputBytes += Net.printState(cellnames);}
+      if (R.steps < 64 || (R.steps & 63) == 0){
+        end = now();
+        if (end - start >= S.maxSeconds){break;}
+      }
+    }
+    fflush(stdout);
+    R.runTime = now() - start;
+    R.ok = true;
+    if (write(fds[1], &R, sizeof(R)) != sizeof(R)){_exit(1);}
+    _exit(0);
+  }
+  close(fds[1]);
+  BenchTrial child;
+  ssize_t got = read(fds[0], &child, sizeof(child));
+  close(fds[0]);
+  int status = 0;
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  wait4(pid, &status, 0, &usage);
+  if (got == sizeof(child) && WIFEXITED(status) && !WEXITSTATUS(status)){
+    R = child;
+    R.peakRSS = usage.ru_maxrss;
+  }
+  return R;
+}
+
+/// \brief Returns the median of the given values.
+static double median(std::vector<double> v){
+  if (!v.size()){return 0;}
+  std::sort(v.begin(), v.end());
+  if (v.size() % 2){return v[v.size() / 2];}
+  return (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+}
+
+/// \brief Escapes a string for use inside a JSON string literal.
+static std::string jsonEscape(std::string in){
+  std::string out;
+  for (size_t i = 0; i < in.size(); ++i){
+    if (in[i] == '"' || in[i] == '\\'){out += '\\';}
+    if ((unsigned char)in[i] < 0x20){continue;}
+    out += in[i];
+  }
+  return out;
+}
+
+/// \brief Extracts the value of the given key from a single-line JSON object as written by this program.
+///
+/// This is not a generic JSON parser: it only supports the flat objects written by main, one per line.
+static std::string jsonField(std::string line, std::string key){
+  std::string needle = "\"" + key + "\":";
+  size_t pos = line.find(needle);
+  if (pos == std::string::npos){return "";}
+  pos += needle.size();
+  if (line[pos] == '"'){
+    size_t end = line.find('"', pos + 1);
+    return line.substr(pos + 1, end - pos - 1);
+  }
+  size_t end = line.find_first_of(",}", pos);
+  return line.substr(pos, end - pos);
+}
+
+/// \brief Reads all result lines from a file written by main, indexed by "net mode engine".
+static std::map<std::string, std::string> readResults(std::string filename){
+  std::map<std::string, std::string> results;
+  FILE * F = fopen(filename.c_str(), "r");
+  if (!F){
+    std::cerr << "Error: Could not read " << filename << std::endl;
+    return results;
+  }
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), F)){
+    std::string line = buf;
+    if (line.find("\"net\":") == std::string::npos){continue;}
+    results[jsonField(line, "net") + " " + jsonField(line, "mode") + " " + jsonField(line, "engine")] = line;
+  }
+  fclose(F);
+  return results;
+}
+
+/// \brief Compares current results against a baseline, printing a table and flagging regressions.
+///
+/// Steps per second lower than the baseline, or load time, compile time or peak memory higher than the baseline, by more than threshold percent count as regressions.
+/// \returns 0 if no regressions were found, 1 otherwise.
+static int compareResults(std::string baseFile, std::string currentFile, double threshold){
+  std::map<std::string, std::string> base = readResults(baseFile);
+  std::map<std::string, std::string> current = readResults(currentFile);
+  if (!base.size() || !current.size()){return 1;}
+  const char * metrics[4] = {"steps_per_s", "load_s", "compile_s", "peak_rss_kb"};
+  const bool higherIsBetter[4] = {true, false, false, false};
+  unsigned int regressions = 0;
+  std::map<std::string, std::string>::iterator it;
+  for (it = current.begin(); it != current.end(); it++){
+    if (!base.count(it->first)){
+      printf("%-60s (no baseline)\n", it->first.c_str());
+      continue;
+    }
+    printf("%s\n", it->first.c_str());
+    for (int m = 0; m < 4; ++m){
+      double b = atof(jsonField(base[it->first], metrics[m]).c_str());
+      double c = atof(jsonField(it->second, metrics[m]).c_str());
+      double change = b ? (c - b) / b * 100 : 0;
+      bool worse = higherIsBetter[m] ? (change < -threshold) : (change > threshold);
+      //Very short load and compile times are too noisy to compare
+      if (m == 1 || m == 2){worse = worse && c - b > 0.01;}
+      printf("  %-12s %14.4f -> %14.4f (%+7.2f%%)%s\n", metrics[m], b, c, change, worse ? " REGRESSION" : "");
+      if (worse){regressions++;}
+    }
+  }
+  printf("%u regressions found (threshold %.1f%%)\n", regressions, threshold);
+  return regressions ? 1 : 0;
+}
+
+/// \brief Runs the benchmark matrix, or compares saved results.
+///
+/// Usage: PetriBench [options] net...
+/// Each net is either a Snoopy file name, or gen:family:size[:seed] to benchmark a net made by PetriGen.
+/// Options:
+/// - --modes=LIST: comma-separated step modes to run, default single,maxautoconcurrent.
+/// - --engines=LIST: comma-separated engines to run, default all.
+/// - --isa=NAME: limit SIMD engines to the scalar, avx2 or avx512 instruction set, default the best available.
+/// - --threads=N: scan threads for compiled engines, default 1.
+/// - --components: grow maximal steps per conflict component on the compiled engines.
+/// - --reserve: grow maximal steps by threads reserving tokens on the compiled engines. Not reproducible with more than one thread.
+/// - --trials=N: measured trials per combination, default 3.
+/// - --warmup=N: steps before measuring, default 1000.
+/// - --steps=N: maximum measured steps per trial, default 100000.
+/// - --seconds=N: maximum measured seconds per trial, default 10.
+/// - --print=N: print the state every N steps, default 1000.
+/// - --seed=N: seed of the first trial, default 1.
+/// - --timeout=N: kill trials taking longer than N seconds in total, default 60.
+/// - --output=FILE: write JSON results to FILE instead of standard output.
+/// - --compare=BASELINE: instead of running, compare the results file given as argument to BASELINE.
+/// - --threshold=N: percentage beyond which a difference counts as regression, default 5.
+/// \returns 1 on wrong command line options or regressions, 0 otherwise.
+int main(int argc, char ** argv){
+  std::map<std::string, std::string> options;
+  std::vector<std::string> nets;
+  for (int i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    if (arg.size() > 2 && arg.substr(0, 2) == "--"){
+      size_t eq = arg.find('=');
+      if (eq == std::string::npos){
+        options[arg.substr(2)] = "";
+      }else{
+        options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+      }
+      continue;
+    }
+    nets.push_back(arg);
+  }
+  if (!nets.size()){
+    std::cerr << "Usage: " << argv[0] << " [--modes=single,maxautoconcurrent] [--engines=all] [--isa=scalar|avx2|avx512] [--threads=1] [--components|--reserve] [--trials=3] [--warmup=1000] [--steps=100000] [--seconds=10] [--print=1000] [--seed=1] [--timeout=60] [--output=file] net_file_or_gen:family:size[:seed] ..." << std::endl;
+    std::cerr << "       " << argv[0] << " --compare=baseline.json [--threshold=5] results.json" << std::endl;
+    return 1;
+  }
+  if (options.count("compare")){
+    double threshold = options.count("threshold") ? atof(options["threshold"].c_str()) : 5;
+    return compareResults(options["compare"], nets[0], threshold);
+  }
+
+  BenchSettings S;
+  S.warmup = options.count("warmup") ? strtoull(options["warmup"].c_str(), 0, 10) : 1000;
+  S.steps = options.count("steps") ? strtoull(options["steps"].c_str(), 0, 10) : 100000;
+  S.maxSeconds = options.count("seconds") ? atof(options["seconds"].c_str()) : 10;
+  S.printInterval = options.count("print") ? atoi(options["print"].c_str()) : 1000;
+  S.seed = options.count("seed") ? strtoull(options["seed"].c_str(), 0, 10) : 1;
+  S.timeout = options.count("timeout") ? atoi(options["timeout"].c_str()) : 60;
+  unsigned int trials = options.count("trials") ? atoi(options["trials"].c_str()) : 3;
+  S.isa = options.count("isa") ? parseIsa(options["isa"]) : 0;
+  if (options.count("isa") && !S.isa){
+    std::cerr << "isa must be one of: scalar, avx2, avx512. Aborting." << std::endl;
+    return 1;
+  }
+  S.threads = options.count("threads") ? atoi(options["threads"].c_str()) : 1;
+  S.split = options.count("components") ? SPLIT_COMPONENTS : (options.count("reserve") ? SPLIT_RESERVE : SPLIT_NONE);
+  if (S.printInterval < 1 || trials < 1 || S.timeout < 1 || S.threads < 1){
+    std::cerr << "print, trials, timeout and threads must be >= 1. Aborting." << std::endl;
+    return 1;
+  }
+
+  std::vector<int> modes, engines;
+  std::vector<std::string> list = splitList(options.count("modes") ? options["modes"] : "single,maxautoconcurrent");
+  for (unsigned int i = 0; i < list.size(); ++i){
+    if (!parseStepMode(list[i])){
+      std::cerr << "Unknown step mode " << list[i] << ". Aborting." << std::endl;
+      return 1;
+    }
+    modes.push_back(parseStepMode(list[i]));
+  }
+  if (options.count("engines") && options["engines"] != "all"){
+    list = splitList(options["engines"]);
+    for (unsigned int i = 0; i < list.size(); ++i){
+      if (!parseEngine(list[i])){
+        std::cerr << "Unknown engine " << list[i] << ". Aborting." << std::endl;
+        return 1;
+      }
+      engines.push_back(parseEngine(list[i]));
+    }
+  }else{
+    for (int e = 1; engineName(e) != "unknown"; ++e){engines.push_back(e);}
+  }
+
+  //Generate any synthetic nets into temporary files
+  std::vector<std::string> netFiles, tempFiles;
+  for (unsigned int i = 0; i < nets.size(); ++i){
+    if (nets[i].substr(0, 4) != "gen:"){
+      netFiles.push_back(nets[i]);
+      continue;
+    }
+    std::vector<std::string> parts;
+    std::stringstream in(nets[i]);
+    std::string part;
+    while (std::getline(in, part, ':')){parts.push_back(part);}
+    PetriGenerator gen(parts.size() > 3 ? strtoull(parts[3].c_str(), 0, 10) : 1);
+    if (parts.size() < 3 || !gen.generate(parts[1], strtoull(parts[2].c_str(), 0, 10))){
+      std::cerr << "Invalid net specification " << nets[i] << ", expected gen:family:size[:seed] with family one of: " << PetriGenerator::families() << ". Aborting." << std::endl;
+      return 1;
+    }
+    char tmpName[] = "/tmp/petribench_XXXXXX";
+    int fd = mkstemp(tmpName);
+    FILE * F = (fd < 0) ? 0 : fdopen(fd, "w");
+    if (!F){
+      std::cerr << "Could not create temporary file. Aborting." << std::endl;
+      return 1;
+    }
+    gen.write(F);
+    fclose(F);
+    netFiles.push_back(tmpName);
+    tempFiles.push_back(tmpName);
+  }
+
+  FILE * out = stdout;
+  if (options.count("output")){
+    out = fopen(options["output"].c_str(), "w");
+    if (!out){
+      std::cerr << "Could not write " << options["output"] << ". Aborting." << std::endl;
+      return 1;
+    }
+  }
+  fprintf(out, "{\"benchmark\":\"PetriBench\",\"trials\":%u,\"warmup\":%llu,\"max_steps\":%llu,\"max_seconds\":%g,\"print_interval\":%u,\"results\":[\n", trials, S.warmup, S.steps, S.maxSeconds, S.printInterval);
+  bool first = true;
+  for (unsigned int n = 0; n < netFiles.size(); ++n){
+    for (unsigned int m = 0; m < modes.size(); ++m){
+      for (unsigned int e = 0; e < engines.size(); ++e){
+        std::cerr << "Benchmarking " << nets[n] << " " << stepModeName(modes[m]) << " " << engineName(engines[e]) << "..." << std::flush;
+        std::vector<double> load, compile, rate;
+        unsigned long long steps = 0, bytes = 0;
+        long rss = 0;
+        unsigned int failed = 0;
+        for (unsigned int t = 0; t < trials; ++t){
+          BenchTrial R = runTrial(netFiles[n], modes[m], engines[e], t, S);
+          if (!R.ok){failed++; continue;}
+          load.push_back(R.loadTime);
+          compile.push_back(R.compileTime);
+          rate.push_back(R.runTime > 0 ? R.steps / R.runTime : 0);
+          if (R.steps > steps){steps = R.steps;}
+          if (R.outputBytes > bytes){bytes = R.outputBytes;}
+          if (R.peakRSS > rss){rss = R.peakRSS;}
+        }
+        std::sort(rate.begin(), rate.end());
+        std::cerr << " " << median(rate) << " steps/s" << (failed ? " (some trials failed)" : "") << std::endl;
+        fprintf(out, "%s{\"net\":\"%s\",\"mode\":\"%s\",\"engine\":\"%s\",\"trials\":%u,\"failed\":%u,\"load_s\":%.6f,\"compile_s\":%.6f,\"steps\":%llu,\"steps_per_s\":%.1f,\"steps_per_s_min\":%.1f,\"steps_per_s_max\":%.1f,\"peak_rss_kb\":%ld,\"output_bytes\":%llu}", first ? "" : ",\n", jsonEscape(nets[n]).c_str(), stepModeName(modes[m]).c_str(), engineName(engines[e]).c_str(), trials, failed, median(load), median(compile), steps, median(rate), rate.size() ? rate[0] : 0.0, rate.size() ? rate[rate.size() - 1] : 0.0, rss, bytes);
+        first = false;
+      }
+    }
+  }
+  fprintf(out, "\n]}\n");
+  if (out != stdout){fclose(out);}
+  for (unsigned int i = 0; i < tempFiles.size(); ++i){remove(tempFiles[i].c_str());}
+  return 0;
+}
@@ -0,0 +1,33 @@
+/// \file gen.cpp
+/// \brief PetriGen main function.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petrigen.h" //synthetic net generator
+#include <iostream> //for std::cerr
+#include <string> //for std::string
+#include <stdlib.h> //for strtoull()
+
+/// \brief Generates a synthetic Snoopy net and writes it to standard output.
+///
+/// Usage: PetriGen family size [seed=1] [tokens]
+/// The size is the approximate amount of nodes (places plus transitions) and may range from 10 to well over 10^7.
+/// The optional tokens argument overrides the default initial token count of families that support it.
+/// \returns 1 on wrong command line options, 0 on success.
+int main(int argc, char ** argv){
+  if (argc < 3){
+    std::cerr << "Usage: " << argv[0] << " family size [seed=1 [tokens]] > net.spept" << std::endl;
+    std::cerr << "Families: " << PetriGenerator::families() << std::endl;
+    return 1;
+  }
+  unsigned long long size = strtoull(argv[2], 0, 10);
+  unsigned long long seed = 1;
+  if (argc > 3){seed = strtoull(argv[3], 0, 10);}
+  PetriGenerator gen(seed);
+  if (argc > 4){gen.tokens = strtoull(argv[4], 0, 10);}
+  if (!gen.generate(argv[1], size)){
+    std::cerr << "family must be one of: " << PetriGenerator::families() << ". Aborting." << std::endl;
+    return 1;
+  }
+  gen.write(stdout);
+  return 0;
+}
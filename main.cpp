@@ -5,46 +5,291 @@
 /// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
 
 #include "petricalc.h" //main PetriNet library
+#include "petritrace.h" //runtime trace logging
+#include "petriperf.h" //hardware performance counters
+#include "petritimeline.h" //phase timeline
 #include <iostream> //for std::cerr
 #include <string> //for std::string
+#include <sstream> //for std::stringstream
 #include <time.h> //for time()
 #include <sys/types.h> //for getpid()
+#include <sys/stat.h> //for fstat()
 #include <unistd.h>
+#include <signal.h> //for sigaction()
+#include <sys/wait.h> //for waitpid()
+#include <errno.h> //for errno
+#include <stdlib.h> //for strtoull()
+
+/// Set by the signal handler when a checkpoint was requested (1, SIGUSR1) or a checkpoint and exit were requested (2, SIGTERM).
+static volatile sig_atomic_t checkpointRequest = 0;
+
+/// \brief Signal handler for SIGUSR1 and SIGTERM. Only sets a flag, the main loop does the actual work.
+static void onCheckpointSignal(int sig){
+  checkpointRequest = (sig == SIGTERM) ? 2 : 1;
+}
+
+/// Set by the signal handler when the run should stop early, to the number of the signal received.
+static volatile sig_atomic_t stopRequest = 0;
+
+/// \brief Signal handler for SIGINT and SIGTERM while recording a timeline, so the timeline is still written at exit.
+static void onStopSignal(int sig){
+  stopRequest = sig;
+}
+
+/// \brief Runs the program command[0] with the given arguments, searching the PATH, and waits for it.
+/// Returns its exit status, or -1 if it could not be started or did not exit normally.
+static int runCommand(std::vector<std::string> & command){
+  std::vector<char *> argv;
+  for (unsigned int i = 0; i < command.size(); ++i){argv.push_back((char *)command[i].c_str());}
+  argv.push_back(0);
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0){return -1;}
+  if (!pid){
+    execvp(argv[0], &argv[0]);
+    fprintf(stderr, "Could not run %s\n", argv[0]);
+    _exit(127);
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0){
+    if (errno != EINTR){return -1;}
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
 
 /// \brief Loads a Snoopy XML file and attempts to run a simulation on it.
 /// 
-/// Usage: PetriCalc snoopy_petrinet_filename [print every this many steps, default 1] [space-separated list of places to output, by default all places]
+/// Usage: PetriCalc [options] snoopy_petrinet_filename [print every this many steps, default 1] [space-separated list of places to output, by default all places]
 /// Simulation will stop once no more transitions are enabled, or continue indefinitely if this never happens.
-/// \returns 1 on wrong command line options, 0 on simulation completion.
+///
+/// Options are given as --name=value and may appear anywhere on the command line:
+/// - --seed=N: seed for the random number generator, defaults to the process ID.
+/// - --engine=NAME: stepping engine to use, default map. All engines give identical results for the same seed.
+/// - --isa=NAME: limit SIMD engines to the scalar, avx2 or avx512 instruction set. By default the best one the CPU supports is used.
+/// - --threads=N: scan for enabled transitions on N threads, default 1. Only used by compiled engines on nets of at least PARALLEL_MIN_ARCS arcs.
+/// - --components: grow maximal auto-concurrent steps per conflict component, on --threads threads. Steps have the same distribution,
+///   but draw different random numbers than without this option. Results do not depend on the amount of threads.
+/// - --reserve: grow maximal auto-concurrent steps on --threads threads that each reserve tokens for their own share of the enabled transitions.
+///   Scales on nets that are a single conflict component, but with more than one thread runs are not reproducible.
+/// - --width=BITS: keep token counts of the kinds engine in 8, 16, 32 or 64 bits (default), or auto for the narrowest that fits.
+///   Counts that outgrow the width move to the next wider one. A count leaving the 64-bit range cancels the run.
+///   --components and --reserve always use 64 bits.
+/// - --adaptive[=N]: during the first N scans (default ADAPTIVE_WARMUP_SCANS) count how often each arc disables its transition,
+///   periodically reordering the arcs of every transition to check the most selective ones first. Only used by --isa=scalar scans.
+/// - --save-arc-profile=FILE: with --adaptive, write the failure counts to FILE once the order is fixed.
+/// - --arc-profile=FILE: order the arcs once by failure counts saved by an earlier run, instead of counting them.
+/// - --max-steps=N: stop after N steps, default no limit.
+/// - --replicas=N: instead of printing every step, run N replicas with seeds --seed, --seed + 1 and so on, each until no transitions
+///   are enabled or --max-steps. Prints the final step count and marking of each replica, as a single run with its seed would end.
+///   With --engine=lockstep, single steps of up to ENSEMBLE_LANES replicas are taken together using SIMD instructions.
+///   --threads=N runs replicas on N threads instead of splitting scans. Replicas run in batches of ENSEMBLE_BATCH_STEPS steps,
+///   and threads without work take over waiting replicas or batches from other threads. Results do not depend on the amount of threads.
+/// - --numa: with --replicas, place the threads evenly over the NUMA nodes of the machine. Every node gets its own copy of the net,
+///   replica markings live on the node that first runs them, and threads take over work from their own node first.
+/// - --target=PLACE:HALFWIDTH[,...]: with --replicas, stop early once the confidence interval of the mean final marking of every
+///   listed place is at most HALFWIDTH to either side. --replicas becomes the budget. Checked after every wave of replicas,
+///   and never before ENSEMBLE_MIN_REPLICAS replicas, so the stopping point does not depend on the amount of threads.
+/// - --confidence=P: confidence level of the --target intervals, between 0 and 1, default 0.95.
+/// - --wave=N: replicas run between --target checks, default ENSEMBLE_WAVE.
+/// - --time-average: estimate the mean marking over all steps of each replica for --target, instead of the final marking.
+/// - --checkpoint=FILE: periodically, on SIGUSR1 and on SIGTERM write a snapshot of the simulation to FILE. SIGTERM exits after writing.
+/// - --checkpoint-interval=N: seconds between periodic checkpoints, default 600.
+/// - --resume=FILE: continue from a snapshot instead of the initial marking. Redirect output with >> to continue the previous output file.
+/// - --metrics=FILE: write runtime counters as JSON lines to FILE, periodically and at exit. Use fd:N for an open file descriptor, or - for stderr.
+///   A human readable summary is printed to stderr at exit.
+/// - --metrics-interval=N: seconds between periodic metrics snapshots, default 1.
+/// - --trace=SPEC: trace events as comma-separated category[:level] entries, with category one of load, combine, range, step or all.
+///   A single number N traces what compiling with DEBUG=N used to print.
+/// - --trace-file=FILE: write trace output to FILE instead of stderr.
+/// - --perf: count cycles, instructions, cache misses and branch misses per phase through perf_event_open.
+///   Printed as per-step averages with the summary at exit, and included in the metrics JSON.
+/// - --timeline=FILE: record load, compile, simulation batches, slow output and checkpoints as spans, written to FILE at exit.
+///   SIGINT and SIGTERM (without --checkpoint) stop the run cleanly, so the timeline is also written for interrupted runs.
+///   The file is Chrome trace event JSON, for chrome://tracing or ui.perfetto.dev.
+/// - --codegen=NAME: instead of simulating, write the net as a specialised simulator to NAME.cpp and compile it into NAME.
+///   The compiler is $CXX (default g++) with $CXXFLAGS (default -O3 -march=native). The step type, print interval and places
+///   given on the command line become the defaults of the generated simulator, which prints the same output as PetriCalc.
+/// \returns 1 on wrong command line options or failed code generation, 0 on simulation completion, 143 after a checkpoint on SIGTERM, 128 + signal number when stopped while recording a timeline.
 int main(int argc, char ** argv){
-  //Initialize the random number generator with the current PID.
-  //Comment out if randomness (each run being different) isn't wanted.
-  srand(getpid());
+  //Separate --name=value options from the positional arguments
+  std::map<std::string, std::string> options;
+  int argCount = 0;
+  for (int i = 0; i < argc; ++i){
+    std::string arg = argv[i];
+    if (i && arg.size() > 2 && arg.substr(0, 2) == "--"){
+      size_t eq = arg.find('=');
+      if (eq == std::string::npos){
+        options[arg.substr(2)] = "";
+      }else{
+        options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+      }
+      continue;
+    }
+    argv[argCount++] = argv[i];
+  }
+  argc = argCount;
 
   //Parse the command line - whine if it's obviously invalid
   int printcount = 1;
   int stepmode = SINGLE_STEP;
-  time_t lastSteps = 0, startTime = time(0), lastTime = time(0);
+  unsigned long long lastSteps = 0, startSteps = 0;
+  time_t startTime = time(0), lastTime = time(0), lastCheckpoint = time(0);
   std::map<std::string, unsigned int> cellnames;
   if (argc < 2){
-    std::cerr << "Usage: " << argv[0] << " snoopy_petrinet_filename [[[steptype=single [print_interval=1] space_separated_list_of_places_to_output=all ...]" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " [--seed=N] [--engine=map] [--isa=scalar|avx2|avx512] [--threads=1] [--components|--reserve] [--width=8|16|32|64|auto] [--adaptive[=scans] [--save-arc-profile=file]|--arc-profile=file] [--max-steps=N] [--replicas=N [--numa] [--target=place:halfwidth,... [--confidence=0.95] [--wave=64] [--time-average]]] [--checkpoint=file [--checkpoint-interval=600]] [--resume=file] [--metrics=file|fd:N|- [--metrics-interval=1]] [--trace=category[:level],... [--trace-file=file]] [--perf] [--timeline=file] [--codegen=name] snoopy_petrinet_filename [[[steptype=single [print_interval=1] space_separated_list_of_places_to_output=all ...]" << std::endl;
     return 1;
   }
+  FILE * metrics = 0;
+  time_t metricsInterval = 1, lastMetrics = time(0);
+  if (options.count("metrics")){
+    std::string target = options["metrics"];
+    if (target == "-"){
+      metrics = stderr;
+    }else if (target.substr(0, 3) == "fd:"){
+      metrics = fdopen(atoi(target.substr(3).c_str()), "w");
+    }else{
+      metrics = fopen(target.c_str(), "w");
+    }
+    if (!metrics){
+      std::cerr << "Could not open metrics output " << target << ". Aborting." << std::endl;
+      return 1;
+    }
+    if (options.count("metrics-interval")){
+      metricsInterval = atoi(options["metrics-interval"].c_str());
+      if (metricsInterval < 1){
+        std::cerr << "metrics-interval must be >= 1. Aborting." << std::endl;
+        return 1;
+      }
+    }
+  }
+  std::string checkpointFile = options.count("checkpoint") ? options["checkpoint"] : "";
+  time_t checkpointInterval = 600;
+  if (options.count("checkpoint-interval")){
+    checkpointInterval = atoi(options["checkpoint-interval"].c_str());
+    if (checkpointInterval < 1){
+      std::cerr << "checkpoint-interval must be >= 1. Aborting." << std::endl;
+      return 1;
+    }
+  }
   
   if (argc > 2){
-    stepmode = 0;
-    std::string newMode = argv[2];
-    if (newMode == "single"){stepmode = SINGLE_STEP;}
-    if (newMode == "concurrent"){stepmode = CONCUR_STEP;}
-    if (newMode == "autoconcurrent"){stepmode = AUTOCON_STEP;}
-    if (newMode == "maxconcurrent"){stepmode = MAX_CONCUR_STEP;}
-    if (newMode == "maxautoconcurrent"){stepmode = MAX_AUTOCON_STEP;}
+    stepmode = parseStepMode(argv[2]);
     if (!stepmode){
       std::cerr << "steptype must be one of: single, concurrent, autoconcurrent, maxconcurrent, maxautoconcurrent. Aborting." << std::endl;
       return 1;
     }
   }
 
+  int engine = ENGINE_MAP;
+  if (options.count("engine")){
+    engine = parseEngine(options["engine"]);
+    if (!engine){
+      std::cerr << "engine must be one of:";
+      for (int e = 1; engineName(e) != "unknown"; ++e){std::cerr << " " << engineName(e);}
+      std::cerr << ". Aborting." << std::endl;
+      return 1;
+    }
+  }
+  int isa = 0;
+  if (options.count("isa")){
+    isa = parseIsa(options["isa"]);
+    if (!isa){
+      std::cerr << "isa must be one of: scalar, avx2, avx512. Aborting." << std::endl;
+      return 1;
+    }
+  }
+
+  unsigned int threads = 1;
+  if (options.count("threads")){
+    threads = atoi(options["threads"].c_str());
+    if (threads < 1){
+      std::cerr << "threads must be >= 1. Aborting." << std::endl;
+      return 1;
+    }
+  }
+
+  int split = SPLIT_NONE;
+  if (options.count("components")){split = SPLIT_COMPONENTS;}
+  if (options.count("reserve")){
+    if (split != SPLIT_NONE){
+      std::cerr << "components and reserve cannot be combined. Aborting." << std::endl;
+      return 1;
+    }
+    split = SPLIT_RESERVE;
+  }
+
+  unsigned long long maxSteps = 0;
+  if (options.count("max-steps")){maxSteps = strtoull(options["max-steps"].c_str(), 0, 10);}
+  unsigned int replicas = 0;
+  if (options.count("replicas")){
+    replicas = atoi(options["replicas"].c_str());
+    if (replicas < 1){
+      std::cerr << "replicas must be >= 1. Aborting." << std::endl;
+      return 1;
+    }
+    if (options.count("numa") && threads < 2){
+      std::cerr << "Warning: numa only places threads, use it with --threads" << std::endl;
+    }
+    if (options.count("checkpoint") || options.count("resume")){
+      std::cerr << "replicas cannot be combined with checkpoint or resume. Aborting." << std::endl;
+      return 1;
+    }
+  }
+  if (options.count("numa") && !replicas){
+    std::cerr << "Warning: numa only applies to --replicas, ignoring" << std::endl;
+  }
+  PetriStopRule stopRule;
+  if (options.count("target")){
+    if (!replicas){
+      std::cerr << "target needs --replicas as the maximum amount of replicas. Aborting." << std::endl;
+      return 1;
+    }
+    std::stringstream targets(options["target"]);
+    std::string target;
+    while (std::getline(targets, target, ',')){
+      size_t colon = target.rfind(':');
+      double width = (colon == std::string::npos) ? 0 : atof(target.substr(colon + 1).c_str());
+      if (colon == std::string::npos || colon == 0 || width <= 0){
+        std::cerr << "target must be a comma-separated list of place:halfwidth, with halfwidth > 0. Aborting." << std::endl;
+        return 1;
+      }
+      stopRule.targets[target.substr(0, colon)] = width;
+    }
+  }
+  if (options.count("confidence")){
+    stopRule.confidence = atof(options["confidence"].c_str());
+    if (stopRule.confidence <= 0 || stopRule.confidence >= 1){
+      std::cerr << "confidence must be between 0 and 1. Aborting." << std::endl;
+      return 1;
+    }
+  }
+  if (options.count("wave")){
+    stopRule.wave = atoi(options["wave"].c_str());
+    if (stopRule.wave < 1){
+      std::cerr << "wave must be >= 1. Aborting." << std::endl;
+      return 1;
+    }
+  }
+  stopRule.timeAverage = options.count("time-average");
+  if (!stopRule.targets.size() && (options.count("confidence") || options.count("wave") || stopRule.timeAverage)){
+    std::cerr << "Warning: confidence, wave and time-average only apply to --target, ignoring" << std::endl;
+  }
+
+  unsigned int width = 64;
+  if (options.count("width")){
+    std::string w = options["width"];
+    if (w == "auto"){
+      width = 0;
+    }else{
+      width = atoi(w.c_str());
+      if (width != 8 && width != 16 && width != 32 && width != 64){
+        std::cerr << "width must be one of: 8, 16, 32, 64, auto. Aborting." << std::endl;
+        return 1;
+      }
+    }
+  }
+
   std::cerr << "Step mode: ";
   switch (stepmode){
     case SINGLE_STEP: std::cerr << "single stepping"; break;
@@ -63,9 +308,59 @@ int main(int argc, char ** argv){
     }
   }
 
+  if (options.count("trace")){
+    FILE * traceOut = stderr;
+    if (options.count("trace-file")){
+      traceOut = fopen(options["trace-file"].c_str(), "w");
+      if (!traceOut){
+        std::cerr << "Could not open trace output " << options["trace-file"] << ". Aborting." << std::endl;
+        return 1;
+      }
+    }
+    if (!traceConfigure(options["trace"], traceOut)){
+      std::cerr << "trace must be a comma-separated list of category[:level] with category one of: load, combine, range, step, all. Aborting." << std::endl;
+      return 1;
+    }
+  }
+
+  if (options.count("timeline")){
+    if (!timelineConfigure(options["timeline"])){
+      std::cerr << "Could not open timeline output " << options["timeline"] << ". Aborting." << std::endl;
+      return 1;
+    }
+  }
+
+  //Open the hardware counters before loading, so loading and compiling are measured too
+  PetriPerf perf;
+  if (options.count("perf")){
+    if (!perf.open()){
+      std::cerr << "Warning: could not open any hardware performance counters, check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+    }
+  }
+
   //Load the net into memory
   std::cerr << "Loading " << argv[1] << "..." << std::endl;
+  perf.mark();
+  unsigned long long loadStart = TIMELINE_ON ? timelineNow() : 0;
   PetriNet Net(argv[1]);
+  if (TIMELINE_ON){timelineSpan("load", loadStart, timelineNow());}
+  perf.phase(PERF_PHASE_LOAD);
+  //Code generation works from the per-kind arcs, whatever engine was asked for
+  if (options.count("codegen")){engine = ENGINE_KINDS;}
+  Net.compile(engine, isa, threads, split, width);
+  if (options.count("arc-profile")){
+    if (!Net.loadArcProfile(options["arc-profile"])){return 1;}
+  }else if (options.count("adaptive")){
+    unsigned long long warmup = ADAPTIVE_WARMUP_SCANS;
+    if (options["adaptive"].size()){warmup = strtoull(options["adaptive"].c_str(), 0, 10);}
+    Net.adaptArcOrder(warmup, options.count("save-arc-profile") ? options["save-arc-profile"] : "");
+  }
+  perf.phase(PERF_PHASE_COMPILE);
+  if (perf.available()){Net.stats.perf = &perf;}
+  //Initialize the random number generator with the given seed, or with the current PID so each run is different.
+  unsigned long long seed = getpid();
+  if (options.count("seed")){seed = strtoull(options["seed"].c_str(), 0, 10);}
+  Net.seed(seed);
 
   //Parse more command line if argument count > 4 (= the places we want to print)
   if (argc > 4){
@@ -75,26 +370,130 @@ int main(int argc, char ** argv){
     }
   }
 
-  //Print the header for output
-  unsigned int steps = 0;
-  Net.printStateHeader(cellnames);
-  Net.printState(cellnames);
+  if (options.count("codegen")){
+    std::string name = options["codegen"];
+    if (!name.size()){
+      std::cerr << "codegen needs an output name. Aborting." << std::endl;
+      return 1;
+    }
+    if (!Net.generateCode(name + ".cpp", cellnames, stepmode, printcount)){return 1;}
+    //The compiler runs without a shell, so the name is never interpreted; $CXX and $CXXFLAGS are split on whitespace
+    std::vector<std::string> command;
+    std::string words = std::string(getenv("CXX") ? getenv("CXX") : "g++") + " " + (getenv("CXXFLAGS") ? getenv("CXXFLAGS") : "-O3 -march=native");
+    std::stringstream wordStream(words);
+    std::string word;
+    while (wordStream >> word){command.push_back(word);}
+    command.push_back("-o");
+    command.push_back(name);
+    command.push_back(name + ".cpp");
+    std::cerr << "Wrote " << name << ".cpp, compiling:";
+    for (unsigned int i = 0; i < command.size(); ++i){std::cerr << " " << command[i];}
+    std::cerr << std::endl;
+    unsigned long long compileStart = TIMELINE_ON ? timelineNow() : 0;
+    int result = runCommand(command);
+    if (TIMELINE_ON){timelineSpan("codegen compile", compileStart, timelineNow());}
+    if (result){
+      std::cerr << "Compiling " << name << ".cpp failed. Aborting." << std::endl;
+      return 1;
+    }
+    std::cerr << "Compiled " << name << std::endl;
+    return 0;
+  }
+
+  if (replicas){
+    if (!Net.runEnsemble(stepmode, replicas, seed, maxSteps, threads, options.count("numa"), stopRule, cellnames)){return 1;}
+    if (metrics){Net.stats.writeJSON(metrics, true);}
+    if (metrics || Net.stats.perf){Net.stats.report(stderr);}
+    return 0;
+  }
+
+  unsigned long long steps = 0;
+  if (options.count("resume")){
+    //Restore the snapshot and cut the output back to where it was when the snapshot was made
+    long long outputPos = -1;
+    if (!Net.loadCheckpoint(options["resume"], stepmode, steps, outputPos)){return 1;}
+    struct stat st;
+    if (outputPos >= 0 && !fstat(fileno(stdout), &st) && S_ISREG(st.st_mode)){
+      if (st.st_size >= outputPos){
+        if (ftruncate(fileno(stdout), outputPos) || fseek(stdout, outputPos, SEEK_SET)){
+          std::cerr << "Warning: could not rewind output to the checkpoint position" << std::endl;
+        }
+      }else{
+        std::cerr << "Warning: output file is shorter than when the checkpoint was made, appending" << std::endl;
+      }
+    }
+    std::cerr << "Resuming from " << options["resume"] << " at step " << steps << std::endl;
+    lastSteps = startSteps = steps;
+  }else{
+    //Print the header for output
+    Net.printStateHeader(cellnames);
+    Net.printState(cellnames);
+  }
+  if (checkpointFile.size()){
+    struct sigaction sa;
+    sa.sa_handler = onCheckpointSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGUSR1, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+  }
+  if (TIMELINE_ON){
+    struct sigaction sa;
+    sa.sa_handler = onStopSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, 0);
+    if (!checkpointFile.size()){sigaction(SIGTERM, &sa, 0);}
+  }
+  //Simulation shows up on the timeline as batches of steps of at least a millisecond each
+  unsigned long long batchStart = TIMELINE_ON ? timelineNow() : 0, batchSteps = 0;
   //While we can complete steps...
-  while (Net.calculateStep(stepmode)){
+  while (!stopRequest && (!maxSteps || steps < maxSteps) && Net.calculateStep(stepmode)){
     //Increase the step counter, print state if wanted
     steps++;
+    if (TIMELINE_ON && ++batchSteps % 64 == 0){
+      unsigned long long now = timelineNow();
+      if (now - batchStart >= 1000000){
+        timelineSpan("simulate", batchStart, now, "steps", batchSteps);
+        batchStart = now;
+        batchSteps = 0;
+      }
+    }
     if (steps % printcount == 0){
       Net.printState(cellnames);
     }
+    //Write a checkpoint if requested by signal or when the interval has passed
+    if (checkpointFile.size() && (checkpointRequest || time(0) - lastCheckpoint >= checkpointInterval)){
+      fflush(stdout);
+      Net.saveCheckpoint(checkpointFile, stepmode, steps, ftell(stdout));
+      lastCheckpoint = time(0);
+      if (checkpointRequest == 2){
+        std::cerr << "Checkpoint written to " << checkpointFile << " at step " << steps << ", exiting." << std::endl;
+        if (metrics){Net.stats.writeJSON(metrics, true);}
+        if (metrics || Net.stats.perf){Net.stats.report(stderr);}
+        return 143;
+      }
+      checkpointRequest = 0;
+    }
     //Print rough calculation speed approximately once per second
     time_t now = time(0);
     if (now > lastTime){
-      std::cerr << "Calculated " << steps << " steps, avg: " << (steps/(double)(now-startTime)) << "s/s, cur:" << (steps-lastSteps)/(double)(now-lastTime) << " s/s..." << std::endl;
+      std::cerr << "Calculated " << steps << " steps, avg: " << ((steps-startSteps)/(double)(now-startTime)) << "s/s, cur:" << (steps-lastSteps)/(double)(now-lastTime) << " s/s..." << std::endl;
       lastTime = now;
       lastSteps = steps;
     }
+    //Write a metrics snapshot if the interval has passed
+    if (metrics && now - lastMetrics >= metricsInterval){
+      TimelineSpan span("metrics");
+      Net.stats.writeJSON(metrics, false);
+      lastMetrics = now;
+    }
   }
   //No more steps possible, exit cleanly.
+  if (TIMELINE_ON && batchSteps){timelineSpan("simulate", batchStart, timelineNow(), "steps", batchSteps);}
+  if (metrics){Net.stats.writeJSON(metrics, true);}
+  if (metrics || Net.stats.perf){Net.stats.report(stderr);}
+  if (stopRequest){return 128 + stopRequest;}
   return 0;
 }
 
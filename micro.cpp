@@ -0,0 +1,217 @@
+/// \file micro.cpp
+/// \brief PetriMicro main function.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petricalc.h" //main PetriNet library
+#include "petrigen.h" //synthetic nets for the PetriNet kernels
+#include <iostream> //for std::cerr
+#include <string> //for std::string
+#include <vector>
+#include <set>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h> //for strtoull()
+#include <unistd.h> //for mkstemp(), dup2()
+#include <fcntl.h> //for open()
+#include <time.h> //for clock_gettime()
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> //for __rdtsc()
+#endif
+
+/// Results of all kernels are accumulated here, so the compiler cannot optimise them away.
+static volatile unsigned long long sink = 0;
+
+/// \brief Returns a monotonic timestamp in nanoseconds.
+static unsigned long long nanoTime(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// \brief Returns the CPU timestamp counter, or 0 where not available.
+static unsigned long long cycleCount(){
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/// \brief Minimum time in nanoseconds a single measurement should take.
+static unsigned long long minMeasureTime = 50000000;
+
+/// \brief Measures the given kernel, printing ns/op and cycles/op.
+///
+/// The kernel is called with an iteration count and must perform opsPerIteration operations per iteration.
+/// The iteration count is doubled until a call takes at least minMeasureTime, then the best of five calls is reported.
+/// Cycles are timestamp counter ticks, which run at a constant rate on modern CPUs.
+template <class Kernel> static void measure(std::string name, std::string params, unsigned long long opsPerIteration, Kernel kernel){
+  unsigned long long iterations = 1;
+  while (true){
+    unsigned long long start = nanoTime();
+    kernel(iterations);
+    if (nanoTime() - start >= minMeasureTime || iterations >= (1ull << 40)){break;}
+    iterations *= 2;
+  }
+  double bestNs = 0, bestCycles = 0;
+  for (int r = 0; r < 5; ++r){
+    unsigned long long startNs = nanoTime(), startCycles = cycleCount();
+    kernel(iterations);
+    double cycles = (cycleCount() - startCycles) / (double)(iterations * opsPerIteration);
+    double ns = (nanoTime() - startNs) / (double)(iterations * opsPerIteration);
+    if (!r || ns < bestNs){
+      bestNs = ns;
+      bestCycles = cycles;
+    }
+  }
+  printf("%-36s %-18s %12.2f %12.2f\n", name.c_str(), params.c_str(), bestNs, bestCycles);
+  fflush(stdout);
+}
+
+/// \brief Returns a random arc as addEdge would create it for one of the edge types, with multiplicity 1 to 4.
+static PetriArc randomArc(PetriRandom & rng){
+  long long m = 1 + rng.below(4);
+  switch (rng.below(5)){
+    case EDGE_ACTIVATOR: return PetriArc(0, m, INFTY, 0, false);
+    case EDGE_INHIBITOR: return PetriArc(0, 0, m - 1, 0, false);
+    case EDGE_RESET: return PetriArc(0, 0, INFTY, 0, true);
+    case EDGE_EQUAL: return PetriArc(0, m, m, 0, false);
+  }
+  if (rng.below(2)){return PetriArc(0, 0, INFTY, m, false);}
+  return PetriArc(m, m, INFTY, -m, false);
+}
+
+/// \brief Returns a string of the form "name=value".
+static std::string param(std::string name, unsigned long long value){
+  std::stringstream out;
+  out << name << "=" << value;
+  return out.str();
+}
+
+/// \brief Runs isolated timings of the PetriArc, PetriSuperTrans and PetriNet primitives.
+///
+/// Usage: PetriMicro [--filter=substring] [--max-size=100000] [--time=50]
+/// Only kernels whose name contains the filter are run. PetriNet kernels use scalefree nets from PetriGen, up to max-size nodes.
+/// Every kernel is timed for at least the given amount of milliseconds per measurement.
+/// \returns 1 on wrong command line options, 0 otherwise.
+int main(int argc, char ** argv){
+  std::string filter;
+  unsigned long long maxSize = 100000;
+  for (int i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    if (arg.substr(0, 9) == "--filter="){filter = arg.substr(9); continue;}
+    if (arg.substr(0, 11) == "--max-size="){maxSize = strtoull(arg.substr(11).c_str(), 0, 10); continue;}
+    if (arg.substr(0, 7) == "--time="){minMeasureTime = strtoull(arg.substr(7).c_str(), 0, 10) * 1000000ull; continue;}
+    std::cerr << "Usage: " << argv[0] << " [--filter=substring] [--max-size=100000] [--time=50]" << std::endl;
+    return 1;
+  }
+  PetriRandom rng;
+  rng.seed(42);
+  printf("%-36s %-18s %12s %12s\n", "kernel", "parameters", "ns/op", "cycles/op");
+
+  //PetriArc kernels, over 4096 random arcs and markings so branch prediction cannot learn the pattern
+  const unsigned int arcCount = 4096;
+  std::vector<PetriArc> arcs;
+  std::vector<unsigned long long> markings;
+  for (unsigned int i = 0; i < arcCount; ++i){
+    arcs.push_back(randomArc(rng));
+    markings.push_back(rng.below(6));
+  }
+  if (std::string("PetriArc::rangeFunction").find(filter) != std::string::npos){
+    for (unsigned long long maxTokens = 1; maxTokens <= 1024; maxTokens *= 32){
+      for (unsigned int i = 0; i < arcCount; ++i){markings[i] = rng.below(maxTokens + 1);}
+      measure("PetriArc::rangeFunction", param("max_tokens", maxTokens), arcCount, [&](unsigned long long n){
+        unsigned long long total = 0;
+        for (unsigned long long it = 0; it < n; ++it){
+          for (unsigned int i = 0; i < arcCount; ++i){total += arcs[i].rangeFunction(markings[i]);}
+        }
+        sink += total;
+      });
+    }
+  }
+  if (std::string("PetriArc::effectFunction").find(filter) != std::string::npos){
+    measure("PetriArc::effectFunction", param("arcs", arcCount), arcCount, [&](unsigned long long n){
+      for (unsigned long long it = 0; it < n; ++it){
+        for (unsigned int i = 0; i < arcCount; ++i){arcs[i].effectFunction(markings[i]);}
+      }
+      sink += markings[0];
+    });
+  }
+  if (std::string("PetriArc::combine").find(filter) != std::string::npos){
+    measure("PetriArc::combine", param("arcs", arcCount), arcCount, [&](unsigned long long n){
+      for (unsigned long long it = 0; it < n; ++it){
+        PetriArc total;
+        for (unsigned int i = 0; i < arcCount; ++i){total.combine(arcs[i]);}
+        sink += total.rangeUsed;
+      }
+    });
+  }
+
+  //PetriSuperTrans::isCombinedEnabled, adding a transition with the given amount of arcs to a super-transition over as many places
+  if (std::string("PetriSuperTrans::isCombinedEnabled").find(filter) != std::string::npos){
+    for (unsigned int fanIn = 1; fanIn <= 64; fanIn *= 4){
+      PetriSuperTrans super;
+      std::map<unsigned long long, PetriArc> add;
+      std::map<unsigned long long, unsigned long long> marking;
+      for (unsigned int p = 0; p < fanIn; ++p){
+        marking[p] = 1000;
+        super.myArcs[p] = PetriArc(1, 1, INFTY, -1, false);
+        add[p] = PetriArc(1, 1, INFTY, -1, false);
+      }
+      measure("PetriSuperTrans::isCombinedEnabled", param("arcs", fanIn), 1, [&](unsigned long long n){
+        unsigned long long total = 0;
+        for (unsigned long long it = 0; it < n; ++it){total += super.isCombinedEnabled(add, marking);}
+        sink += total;
+      });
+    }
+  }
+
+  //PetriNet kernels, over the transitions of scalefree nets of increasing size
+  bool netKernels = std::string("PetriNet::isEnabled").find(filter) != std::string::npos || std::string("PetriNet::pickTransition").find(filter) != std::string::npos;
+  for (unsigned long long size = 100; netKernels && size <= maxSize; size *= 10){
+    PetriGenerator gen(1);
+    gen.generate("scalefree", size);
+    char tmpName[] = "/tmp/petrimicro_XXXXXX";
+    int fd = mkstemp(tmpName);
+    FILE * F = (fd < 0) ? 0 : fdopen(fd, "w");
+    if (!F){
+      std::cerr << "Could not create temporary file. Aborting." << std::endl;
+      return 1;
+    }
+    gen.write(F);
+    fclose(F);
+    //Loading logs to stderr, which would mix with the table when it is redirected
+    fflush(stderr);
+    int savedErr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+    PetriNet Net(tmpName);
+    fflush(stderr);
+    dup2(savedErr, 2);
+    close(devNull);
+    close(savedErr);
+    remove(tmpName);
+    //The net is not compiled, so that all generated transitions are present in the loaded maps
+    Net.seed(1);
+    unsigned int base = gen.transitionIdBase(), count = gen.transitions();
+    if (std::string("PetriNet::isEnabled").find(filter) != std::string::npos){
+      measure("PetriNet::isEnabled", param("places", gen.places()), count, [&](unsigned long long n){
+        unsigned long long total = 0;
+        for (unsigned long long it = 0; it < n; ++it){
+          for (unsigned int t = 0; t < count; ++t){total += Net.isEnabled(base + t);}
+        }
+        sink += total;
+      });
+    }
+    if (std::string("PetriNet::pickTransition").find(filter) != std::string::npos){
+      std::set<unsigned long long> enabled;
+      for (unsigned int t = 0; t < count; ++t){enabled.insert(base + t);}
+      measure("PetriNet::pickTransition", param("enabled", count), 1, [&](unsigned long long n){
+        unsigned long long total = 0;
+        for (unsigned long long it = 0; it < n; ++it){total += *Net.pickTransition(enabled);}
+        sink += total;
+      });
+    }
+  }
+  return 0;
+}
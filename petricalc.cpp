@@ -5,10 +5,99 @@
 /// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
 
 #include "petricalc.h"
+#include "petritrace.h"
+#include "petritimeline.h"
 #include <deque>
 #include <sstream>
 #include <algorithm>
 #include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/// \brief Creates a generator seeded with zero. Call seed() to get a different sequence.
+PetriRandom::PetriRandom(){
+  seed(0);
+}
+
+/// \brief Seeds the generator, expanding the given 64-bit seed into the full state using splitmix64.
+void PetriRandom::seed(unsigned long long s){
+  for (int i = 0; i < 4; ++i){
+    s += 0x9E3779B97F4A7C15ull;
+    unsigned long long z = s;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    state[i] = z ^ (z >> 31);
+  }
+}
+
+/// \brief Returns the next 64-bit pseudo-random number.
+unsigned long long PetriRandom::next(){
+  unsigned long long result = state[1] * 5;
+  result = ((result << 7) | (result >> 57)) * 9;
+  unsigned long long t = state[1] << 17;
+  state[2] ^= state[0];
+  state[3] ^= state[1];
+  state[1] ^= state[2];
+  state[0] ^= state[3];
+  state[2] ^= t;
+  state[3] = (state[3] << 45) | (state[3] >> 19);
+  return result;
+}
+
+/// \brief Returns a pseudo-random number in the range [0, n).
+unsigned long long PetriRandom::below(unsigned long long n){
+  return next() % n;
+}
+
+/// \brief Returns the step mode constant for the given command line name, or 0 if unknown.
+int parseStepMode(std::string name){
+  if (name == "single"){return SINGLE_STEP;}
+  if (name == "concurrent"){return CONCUR_STEP;}
+  if (name == "autoconcurrent"){return AUTOCON_STEP;}
+  if (name == "maxconcurrent"){return MAX_CONCUR_STEP;}
+  if (name == "maxautoconcurrent"){return MAX_AUTOCON_STEP;}
+  return 0;
+}
+
+/// \brief Returns the command line name of the given step mode constant.
+std::string stepModeName(int stepMode){
+  switch (stepMode){
+    case SINGLE_STEP: return "single";
+    case CONCUR_STEP: return "concurrent";
+    case AUTOCON_STEP: return "autoconcurrent";
+    case MAX_CONCUR_STEP: return "maxconcurrent";
+    case MAX_AUTOCON_STEP: return "maxautoconcurrent";
+  }
+  return "unknown";
+}
+
+/// \brief Returns the engine constant for the given command line name, or 0 if unknown.
+int parseEngine(std::string name){
+  if (name == "map"){return ENGINE_MAP;}
+  if (name == "simd"){return ENGINE_SIMD;}
+  if (name == "bitset"){return ENGINE_BITSET;}
+  if (name == "kinds"){return ENGINE_KINDS;}
+  if (name == "counters"){return ENGINE_COUNTERS;}
+  if (name == "lockstep"){return ENGINE_LOCKSTEP;}
+  return 0;
+}
+
+/// \brief Returns the command line name of the given engine constant.
+std::string engineName(int engine){
+  switch (engine){
+    case ENGINE_MAP: return "map";
+    case ENGINE_SIMD: return "simd";
+    case ENGINE_BITSET: return "bitset";
+    case ENGINE_KINDS: return "kinds";
+    case ENGINE_COUNTERS: return "counters";
+    case ENGINE_LOCKSTEP: return "lockstep";
+  }
+  return "unknown";
+}
 
 /// \brief Base constructor will create a No-Operation arc ((0, 0, inf), 0).
 PetriArc::PetriArc(){
@@ -16,6 +105,8 @@ PetriArc::PetriArc(){
   rangeLow = 0;
   rangeHigh = INFTY;
   effect = 0;
+  effectSetter = false;
+  effectAdded = 0;
 }
 
 /// \brief Fancy constructor will create a given arc labeled as ((rLow, rHigh), e).
@@ -34,9 +125,13 @@ PetriArc::PetriArc(unsigned long long rUsed, unsigned long long rLow, unsigned l
 /// When called, true or false is returned to indicate if this arc can enable connected transitions (true) or not (false).
 bool PetriArc::rangeFunction(unsigned long long m){
   // From definition 8: fr ((l, h), m) = true if l ≤ m ≤ h and u ≤ v, false otherwise
-#if DEBUG >= 8
-  std::cerr << "Arc " << label() << " is " << ((rangeLow <= m && m <= rangeHigh && rangeUsed <= m)?"enabled":"disabled") << " with " << m << " tokens" << std::endl;
-#endif
+  if (TRACE_ON(TRACE_RANGE, 1)){
+    unsigned long long args[TRACE_ARC_WORDS + 2];
+    traceWords(args);
+    args[TRACE_ARC_WORDS] = m;
+    args[TRACE_ARC_WORDS + 1] = (rangeLow <= m && m <= rangeHigh && rangeUsed <= m);
+    traceRecord(EV_RANGE, TRACE_ARC_WORDS + 2, args);
+  }
   return (rangeLow <= m && m <= rangeHigh && rangeUsed <= m);
 }
 
@@ -52,6 +147,38 @@ void PetriArc::effectFunction(unsigned long long & m){
   }
 }
 
+/// \brief Returns false if no marking can ever satisfy the range function of this arc.
+///
+/// This happens when combining arcs results in an empty range, for example an equal arc combined with an inhibitor arc.
+bool PetriArc::isSatisfiable(){
+  return (rangeLow <= rangeHigh && rangeUsed <= rangeHigh);
+}
+
+/// \brief Returns true if both arcs have identical labels, including the internal effectAdded value.
+bool PetriArc::operator==(const PetriArc & rhs) const{
+  return (rangeUsed == rhs.rangeUsed && rangeLow == rhs.rangeLow && rangeHigh == rhs.rangeHigh && effect == rhs.effect && effectSetter == rhs.effectSetter && effectAdded == rhs.effectAdded);
+}
+
+/// \brief Arbitrary strict ordering of arc labels, so that arc sets can be used as map keys.
+bool PetriArc::operator<(const PetriArc & rhs) const{
+  if (rangeUsed != rhs.rangeUsed){return rangeUsed < rhs.rangeUsed;}
+  if (rangeLow != rhs.rangeLow){return rangeLow < rhs.rangeLow;}
+  if (rangeHigh != rhs.rangeHigh){return rangeHigh < rhs.rangeHigh;}
+  if (effect != rhs.effect){return effect < rhs.effect;}
+  if (effectSetter != rhs.effectSetter){return effectSetter < rhs.effectSetter;}
+  return effectAdded < rhs.effectAdded;
+}
+
+/// \brief Writes the arc label into TRACE_ARC_WORDS words, for use as trace record arguments.
+void PetriArc::traceWords(unsigned long long * words){
+  words[0] = rangeUsed;
+  words[1] = rangeLow;
+  words[2] = rangeHigh;
+  words[3] = effect;
+  words[4] = effectSetter;
+  words[5] = effectAdded;
+}
+
 /// \brief Return a human-readable printed arc label.
 std::string PetriArc::label(){
   std::stringstream out;
@@ -70,9 +197,6 @@ std::string PetriArc::label(){
 /// 
 /// When called, this PetriArc and given PetriArc are combined into this PetriArc (irreversibly).
 void PetriArc::combine(PetriArc param){
-  #if DEBUG >= 9
-  std::cerr << " (" << label() << " COMB " << param.label() << ") = ";
-  #endif 
   //Set u to the sum of u1 and u2
   rangeUsed += param.rangeUsed;
   //Set l to the maximum of l1 and l2
@@ -88,9 +212,6 @@ void PetriArc::combine(PetriArc param){
     effectSetter = true;
     effect = effectAdded;
   }
-  #if DEBUG >= 9
-  std::cerr << label() << std::endl;
-  #endif 
 }
 
 /// \brief Checks if this PetriSuperTrans is enabled in the given marking
@@ -156,10 +277,14 @@ bool PetriSuperTrans::isCombinedEnabled(std::map<unsigned long long, PetriArc> &
 /// All other contents of the net are ignored.
 PetriNet::PetriNet(std::string XML){
   TiXmlDocument myXML = TiXmlDocument(XML);
-  if (!myXML.LoadFile()){
-    fprintf(stderr, "Error: Could not read file %s\n", XML.c_str());
-    exit(42);
+  {
+    TimelineSpan span("parse xml");
+    if (!myXML.LoadFile()){
+      fprintf(stderr, "Error: Could not read file %s\n", XML.c_str());
+      exit(42);
+    }
   }
+  TimelineSpan span("build net");
   TiXmlElement * e = myXML.RootElement();
   TiXmlNode * c = e->FirstChild("nodeclasses");
   if (!c){
@@ -173,8 +298,107 @@ PetriNet::PetriNet(std::string XML){
     exit(42);
   }
   parseEdges(c);
+  engine = 0;
 };
 
+/// \brief Stops the scan threads, if any.
+PetriNet::~PetriNet(){
+  delete state.pool;
+}
+
+/// \brief Prepares the loaded net for stepping with the given engine.
+///
+/// Removes dead and duplicate transitions, then builds any data structures the engine needs.
+/// For engines using SIMD instructions, useIsa limits the instruction set used, 0 means the best the CPU supports.
+/// Compiled engines scan large nets on useThreads threads.
+/// useSplit selects how compiled engines split maximal auto-concurrent steps over useThreads threads, see the SPLIT_ constants.
+/// The kinds engine keeps token counts in useWidth bits, 8, 16, 32 or 64, or 0 to pick the narrowest that fits.
+/// Counts that outgrow the width move to the next wider one.
+/// Must be called once, after loading and before the first call to calculateStep.
+void PetriNet::compile(int useEngine, int useIsa, unsigned int useThreads, int useSplit, unsigned int useWidth){
+  TimelineSpan span("compile");
+  reduceTransitions();
+  engine = useEngine;
+  if (engine != ENGINE_MAP){
+    compiled.build(engine, useIsa, useThreads, marking, arcs, weights, transitions);
+    //The arc maps, with the load-time combination data, are only used by the map engine
+    std::map<unsigned long long, std::map<unsigned long long, PetriArc> >().swap(arcs);
+#ifdef __GLIBC__
+    //Hand the freed maps and the parsed XML back to the system, rather than keeping them as free heap for the whole run
+    malloc_trim(0);
+#endif
+    if (compiled.arcWideArc.size()){fprintf(stderr, "%u arcs need more than 32 bits for their range\n", (unsigned int)compiled.arcWideArc.size());}
+    if (useSplit != SPLIT_NONE && engine == ENGINE_BITSET){
+      fprintf(stderr, "The bitset engine does not split maximal steps, ignoring\n");
+    }else if (useSplit == SPLIT_COMPONENTS){
+      compiled.split = useSplit;
+      compiled.buildComponents();
+      fprintf(stderr, "Maximal steps are grown per conflict component, over %u components\n", compiled.componentCount);
+    }else if (useSplit == SPLIT_RESERVE){
+      compiled.split = useSplit;
+      fprintf(stderr, "Maximal steps are grown by %u threads reserving tokens\n", useThreads);
+    }
+    if (engine == ENGINE_KINDS && compiled.split != SPLIT_NONE && useWidth != 64){
+      fprintf(stderr, "Split maximal steps need 64-bit token counts, ignoring the width\n");
+    }else if (engine == ENGINE_KINDS){
+      compiled.width = useWidth;
+    }else if (useWidth != 64){
+      fprintf(stderr, "Only the kinds engine supports narrow token counts, using 64 bits\n");
+    }
+    compiled.initState(state);
+    if (useThreads > 1 && (compiled.chunkStart.size() > 2 || compiled.split != SPLIT_NONE)){state.pool = new PetriPool(useThreads);}
+    if (compiled.chunkStart.size() > 2){
+      fprintf(stderr, "Enabledness scans use %u threads over %u chunks\n", useThreads, (unsigned int)compiled.chunkStart.size() - 1);
+    }else if (useThreads > 1){
+      fprintf(stderr, "Net has fewer than %u arcs, scanning on a single thread\n", PARALLEL_MIN_ARCS);
+    }
+    if (engine == ENGINE_SIMD || engine == ENGINE_LOCKSTEP){fprintf(stderr, "Enabledness scans use %s instructions\n", isaName(compiled.isa).c_str());}
+    if (engine == ENGINE_BITSET && !state.bitsActive){fprintf(stderr, "Net is not 1-safe, using the simd engine with %s instructions\n", isaName(compiled.isa).c_str());}
+    if (engine == ENGINE_KINDS){
+      unsigned int * k = compiled.kindTotal;
+      fprintf(stderr, "Arc kinds: %u read, %u consume, %u produce, %u reset, %u inhibit, %u equal, %u general\n", k[KIND_READ], k[KIND_CONSUME], k[KIND_PRODUCE], k[KIND_RESET], k[KIND_INHIBIT], k[KIND_EQUAL], k[KIND_GENERAL]);
+      fprintf(stderr, "Token counts use %u bits\n", state.width);
+    }
+  }
+}
+
+/// \brief Returns true if the arc order matters to the compiled engine, printing why not otherwise.
+///
+/// Only the scalar scan of the simd and bitset engines stops at the first arc that disables a transition.
+/// SIMD scans evaluate every arc, and the other engines keep their own arc layouts.
+static bool arcOrderMatters(int engine, int isa){
+  if (engine != ENGINE_SIMD && engine != ENGINE_BITSET){
+    fprintf(stderr, "Arc order only applies to the simd and bitset engines, ignoring\n");
+    return false;
+  }
+  if (isa != ISA_SCALAR){
+    fprintf(stderr, "Scans with %s instructions evaluate every arc, so arc order only applies with --isa=scalar, ignoring\n", isaName(isa).c_str());
+    return false;
+  }
+  return true;
+}
+
+/// \brief Reorders the arcs of every transition by how often they disable it, during the first warmupScans scans.
+///
+/// If saveFile is not empty, the observed failure counts are written to it once the order is fixed, for loadArcProfile.
+/// Call after compile.
+void PetriNet::adaptArcOrder(unsigned long long warmupScans, std::string saveFile){
+  if (!arcOrderMatters(engine, compiled.isa)){return;}
+  compiled.adaptArcs(warmupScans, saveFile);
+  fprintf(stderr, "Ordering arcs by failure rate over the first %llu scans\n", warmupScans);
+}
+
+/// \brief Orders the arcs of every transition once, by failure counts saved by an earlier run using adaptArcOrder.
+///
+/// Call after compile. Returns false if the profile could not be read or belongs to a different net, true otherwise,
+/// including when the engine does not use the arc order.
+bool PetriNet::loadArcProfile(std::string filename){
+  if (!arcOrderMatters(engine, compiled.isa)){return true;}
+  if (!compiled.loadArcProfile(filename)){return false;}
+  fprintf(stderr, "Arcs ordered by profile %s\n", filename.c_str());
+  return true;
+}
+
 /// \brief Parses all node types from a Snoopy XML file and calls addPlace or addTransition on all places respectively transitions found in the file.
 void PetriNet::parseNodes(TiXmlNode * N){
   TiXmlNode * c = 0, * d = 0;
@@ -209,6 +433,7 @@ void PetriNet::addPlace(TiXmlNode * N){
   const char * id = e->Attribute("id");
   if (!id){return;}
   unsigned long long ID = atoi(id);
+  marking[ID] = 0;//places without a marking attribute start empty
   TiXmlNode * c = 0;
   while ((c = N->IterateChildren(c))){
     e = c->ToElement();
@@ -227,9 +452,10 @@ void PetriNet::addPlace(TiXmlNode * N){
       marking[ID] = atoi(e->GetText());
     }
   }
-  #if DEBUG >= 10
-  std::cerr << "Added place " << places[ID] << " with " << marking[ID] << " tokens" << std::endl;
-  #endif
+  if (TRACE_ON(TRACE_LOAD, 2)){
+    unsigned long long args[1] = {marking[ID]};
+    traceRecord(EV_ADD_PLACE, 1, args, places[ID].c_str());
+  }
 }
 
 /// \brief Adds a single transition to the net from a Snoopy XML file.
@@ -257,20 +483,11 @@ void PetriNet::addTransition(TiXmlNode * N){
       }
     }
   }
-  #if DEBUG >= 10
-  std::cerr << "Added transition " << transitions[ID] << std::endl;
-  #endif
+  if (TRACE_ON(TRACE_LOAD, 2)){
+    traceRecord(EV_ADD_TRANSITION, 0, 0, transitions[ID].c_str());
+  }
 }
 
-/// Edge types. Only used internally, and only inside parseEdges and addEdge.
-enum edgeType{
-  EDGE_NORMAL,
-  EDGE_ACTIVATOR,
-  EDGE_INHIBITOR,
-  EDGE_RESET,
-  EDGE_EQUAL
-};
-
 /// \brief Parses all edge types from a Snoopy XML file and calls addEdge for each edge found in the file.
 void PetriNet::parseEdges(TiXmlNode * N){
   TiXmlNode * c = 0, * d = 0;
@@ -396,22 +613,108 @@ void PetriNet::addEdge(TiXmlNode * N, unsigned int E){
   }
 
   if (arcs.count(transition) && arcs[transition].count(place)){
-    #if DEBUG >= 9
-    std::cerr << "Combining arc " << transitions[transition] << "<->" << places[place] << ": ";
-    #endif
-    arcs[transition][place].combine(PetriArc(aRUsed, aRLow, aRHigh, aEffect, aEffectSetter));
+    PetriArc added(aRUsed, aRLow, aRHigh, aEffect, aEffectSetter);
+    unsigned long long args[3 * TRACE_ARC_WORDS];
+    if (TRACE_ON(TRACE_COMBINE, 1)){
+      arcs[transition][place].traceWords(args);
+      added.traceWords(args + TRACE_ARC_WORDS);
+    }
+    arcs[transition][place].combine(added);
+    if (TRACE_ON(TRACE_COMBINE, 1)){
+      arcs[transition][place].traceWords(args + 2 * TRACE_ARC_WORDS);
+      traceRecord(EV_COMBINE_ARC, 3 * TRACE_ARC_WORDS, args, transitions[transition].c_str(), places[place].c_str());
+    }
   }else{
     arcs[transition][place] = PetriArc(aRUsed, aRLow, aRHigh, aEffect, aEffectSetter);
-    #if DEBUG >= 10
-    std::cerr << "Inserting arc " << transitions[transition] << "<->" << places[place] << ": " << arcs[transition][place].label() << std::endl;
-    #endif
+    if (TRACE_ON(TRACE_LOAD, 2)){
+      unsigned long long args[TRACE_ARC_WORDS];
+      arcs[transition][place].traceWords(args);
+      traceRecord(EV_INSERT_ARC, TRACE_ARC_WORDS, args, transitions[transition].c_str(), places[place].c_str());
+    }
+  }
+}
+
+/// \brief Removes statically dead transitions and merges transitions with identical combined arc sets.
+///
+/// A transition is statically dead if any of its pt-combined arcs can never satisfy the range function.
+/// Transitions with identical pt-combined arcs are merged into the one with the lowest ID, which is given a weight equal to the amount of merged transitions.
+/// Since pickTransition takes these weights into account, the chance of picking any of the original transitions is unchanged.
+void PetriNet::reduceTransitions(){
+  std::map<unsigned long long, std::map<unsigned long long, PetriArc> >::iterator T;
+  std::map<unsigned long long, PetriArc>::iterator A;
+  std::map<std::map<unsigned long long, PetriArc>, unsigned long long> seen;//arc set to first transition ID with that arc set
+  unsigned int dead = 0, merged = 0;
+  T = arcs.begin();
+  while (T != arcs.end()){
+    bool isDead = false;
+    for (A = T->second.begin(); A != T->second.end(); A++){
+      if (!A->second.isSatisfiable()){isDead = true; break;}
+    }
+    if (isDead){
+      if (TRACE_ON(TRACE_LOAD, 1)){
+        traceRecord(EV_DEAD_TRANSITION, 0, 0, transitions[T->first].c_str());
+      }
+      dead++;
+      arcs.erase(T++);
+      continue;
+    }
+    if (seen.count(T->second)){
+      unsigned long long original = seen[T->second];
+      if (TRACE_ON(TRACE_LOAD, 1)){
+        traceRecord(EV_MERGE_TRANSITION, 0, 0, transitions[T->first].c_str(), transitions[original].c_str());
+      }
+      if (!weights.count(original)){weights[original] = 1;}
+      weights[original]++;
+      merged++;
+      arcs.erase(T++);
+      continue;
+    }
+    seen[T->second] = T->first;
+    T++;
+  }
+  if (dead || merged){
+    fprintf(stderr, "Removed %u dead transitions, merged %u duplicate transitions\n", dead, merged);
   }
 }
 
+/// \brief Picks a random transition from the given set of enabled transitions.
+///
+/// Transitions that represent several merged transitions are picked proportionally to their weight.
+std::set<unsigned long long>::iterator PetriNet::pickTransition(std::set<unsigned long long> & enabled){
+  std::set<unsigned long long>::iterator selector = enabled.begin();
+  if (!weights.size()){
+    std::advance(selector, state.rng.below(enabled.size()));
+    return selector;
+  }
+  unsigned long long total = 0;
+  for (selector = enabled.begin(); selector != enabled.end(); selector++){
+    total += weights.count(*selector) ? weights[*selector] : 1;
+  }
+  unsigned long long r = state.rng.below(total);
+  for (selector = enabled.begin(); selector != enabled.end(); selector++){
+    unsigned long long w = weights.count(*selector) ? weights[*selector] : 1;
+    if (r < w){break;}
+    r -= w;
+  }
+  return selector;
+}
+
 /// \brief Does a single calculation step, following the method given in definition 8.
 /// 
-/// Returns true if a step was completed, false if no more transitions are enabled.
+/// Returns true if a step was completed, false if no more transitions are enabled or the run was cancelled.
 bool PetriNet::calculateStep(int stepMode){
+  if (engine == ENGINE_SIMD || engine == ENGINE_BITSET || engine == ENGINE_KINDS || engine == ENGINE_COUNTERS || engine == ENGINE_LOCKSTEP){
+    bool alive = compiled.step(stepMode, state, stats);
+    if (state.widened){
+      fprintf(stderr, "Token counts no longer fit, continuing with %u bits\n", state.widened);
+      state.widened = 0;
+    }
+    return alive;
+  }
+  if (engine != ENGINE_MAP){
+    std::cerr << "Engine not implemented or net not compiled. Cancelling run." << std::endl;
+    return false;
+  }
 
   std::map<unsigned long long, std::map<unsigned long long, PetriArc> >::iterator T;
   std::map<unsigned long long, PetriArc>::iterator A;
@@ -419,29 +722,37 @@ bool PetriNet::calculateStep(int stepMode){
   std::set<unsigned long long>::iterator selector;
 
 
+  unsigned long long phaseStart = stats.begin();
+
   if (stepMode == SINGLE_STEP){
     //Every transition is checked for enabledness, and made part of a subset consisting of only enabled transitions.
     for (T = arcs.begin(); T != arcs.end(); T++){
       if (isEnabled(T->first)){enabled.insert(T->first);}
     }
+    phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+    stats.enabledHistogram[PetriStats::bucket(enabled.size())]++;
 
-    #if DEBUG >= 5
-    fprintf(stderr, "Single-stepping: %u transitions enabled\n", (unsigned int)enabled.size());
-    #endif
+    if (TRACE_ON(TRACE_STEP, 2)){
+      unsigned long long args[1] = {enabled.size()};
+      traceRecord(EV_SINGLE_ENABLED, 1, args);
+    }
     //Nothing enabled? We're done. Cancel running net.
     if (enabled.size() == 0){return false;}
     //pick a random enabled transition
-    selector = enabled.begin();
-    std::advance(selector, rand() % enabled.size());
-    #if DEBUG >= 4
-    fprintf(stderr, "Single-stepping: picked transition %s\n", transitions[*selector].c_str());
-    #endif
+    selector = pickTransition(enabled);
+    if (TRACE_ON(TRACE_STEP, 1)){
+      traceRecord(EV_SINGLE_PICKED, 0, 0, transitions[*selector].c_str());
+    }
+    phaseStart = stats.phase(PHASE_SELECT, phaseStart);
     //Run the effect function on each arc of the chosen transition.
     //We do not calculate the pt-combined arc label here, since it's been pre-calculated during net load already for each transition
     std::map<unsigned long long, PetriArc> & selected = arcs[*selector];
     for (A = selected.begin(); A != selected.end(); A++){
       A->second.effectFunction(marking[A->first]);
     }
+    stats.phase(PHASE_FIRE, phaseStart);
+    stats.superHistogram[1]++;
+    stats.steps++;
     //Step completed.
     return true;
   }
@@ -451,10 +762,13 @@ bool PetriNet::calculateStep(int stepMode){
     for (T = arcs.begin(); T != arcs.end(); T++){
       if (isEnabled(T->first)){enabled.insert(T->first);}
     }
+    phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+    stats.enabledHistogram[PetriStats::bucket(enabled.size())]++;
 
-    #if DEBUG >= 5
-    fprintf(stderr, "Maximal auto-concurrent stepping: %u transitions enabled\n", (unsigned int)enabled.size());
-    #endif
+    if (TRACE_ON(TRACE_STEP, 2)){
+      unsigned long long args[1] = {enabled.size()};
+      traceRecord(EV_MAX_ENABLED, 1, args);
+    }
     //Nothing enabled? We're done. Cancel running net.
     if (enabled.size() == 0){return false;}
     //prepare empty list of chosen transitions and empty PetriSuperTrans
@@ -462,19 +776,21 @@ bool PetriNet::calculateStep(int stepMode){
     PetriSuperTrans super;
 
     //pick a random enabled transition
-    selector = enabled.begin();
-    std::advance(selector, rand() % enabled.size());
+    selector = pickTransition(enabled);
     chosenTrans[*selector]++;//increment chosen transition counter
     super.combine(arcs[*selector]);//combine the chosen transition into the PetriSuperTrans
     
+    unsigned long long superSize = 1;
     //keep going until no enabled transitions are left to add
     while (enabled.size()){
       //pick a random enabled transition
-      selector = enabled.begin();
-      std::advance(selector, rand() % enabled.size());
+      selector = pickTransition(enabled);
       //would super still be enabled if this transition was added?
+      stats.enabledChecks++;
+      stats.arcsEvaluated += arcs[*selector].size();
       if (super.isCombinedEnabled(arcs[*selector], marking)){
         //if so, add it
+        superSize++;
         chosenTrans[*selector]++;//increment chosen transition counter
         super.combine(arcs[*selector]);//combine the chosen transition into the PetriSuperTrans
       }else{
@@ -484,22 +800,22 @@ bool PetriNet::calculateStep(int stepMode){
     }
 
 
-    #if DEBUG >= 4
-    std::cerr << "Maximal auto-concurrent stepping: picked transitions:";
-    std::map<unsigned long long, unsigned long long>::iterator pckd;
-    for (pckd = chosenTrans.begin(); pckd != chosenTrans.end(); pckd++){
-      std::cerr << " " << transitions[pckd->first];
-      if (pckd->second > 1){
-        std::cerr << " (X" << pckd->second << ")";
+    phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+    stats.superHistogram[PetriStats::bucket(superSize)]++;
+    if (TRACE_ON(TRACE_STEP, 1)){
+      std::map<unsigned long long, unsigned long long>::iterator pckd;
+      for (pckd = chosenTrans.begin(); pckd != chosenTrans.end(); pckd++){
+        unsigned long long args[1] = {pckd->second};
+        traceRecord(EV_MAX_PICKED, 1, args, transitions[pckd->first].c_str());
       }
     }
-    std::cerr << std::endl;
-    #endif
     //Run the effect function on each arc of super.
     std::map<unsigned long long, PetriArc> & selected = super.myArcs;
     for (A = selected.begin(); A != selected.end(); A++){
       A->second.effectFunction(marking[A->first]);
     }
+    stats.phase(PHASE_FIRE, phaseStart);
+    stats.steps++;
     //Step completed.
     return true;
   }
@@ -520,10 +836,12 @@ bool PetriNet::isEnabled(unsigned int T){
   }
 
   // Loop over all p ∈ P such that p‡t
+  stats.enabledChecks++;
   std::map<unsigned long long, PetriArc>::iterator A;
   for (A = arcs[T].begin(); A != arcs[T].end(); A++){
     //Check fR(aR , M (p)), if false, return false
     //We do not calculate the pt-combined arc label here, since it's been pre-calculated during net load already for each transition
+    stats.arcsEvaluated++;
     if (!A->second.rangeFunction(marking[A->first])){return false;}
   }
 
@@ -546,37 +864,294 @@ unsigned int PetriNet::findPlace(std::string placename){
 /// 
 /// The cellnames argument contains a map from place names to place IDs.
 /// If cellnames is empty, prints markings for all places.
-void PetriNet::printState(std::map<std::string, unsigned int> & cellnames){
-  if (cellnames.size()){
+/// Returns the amount of bytes printed.
+unsigned int PetriNet::printState(std::map<std::string, unsigned int> & cellnames){
+  //Only slow calls show up on the timeline, those are the ones blocking on a full pipe or disk
+  TimelineSpan span("output", 100000);
+  unsigned long long phaseStart = stats.begin();
+  unsigned int bytes = 0;
+  if (engine != ENGINE_MAP && engine){
+    //Compiled engines: place indices are in the same order as the marking map
+    if (cellnames.size()){
+      std::map<std::string, unsigned int>::iterator nIter;
+      for (nIter = cellnames.begin(); nIter != cellnames.end(); nIter++){
+        unsigned int p = compiled.placeIndex(nIter->second);
+        bytes += printf("%llu\t", (p < state.tokens.size()) ? compiled.tokenCount(state, p) : 0ull);
+      }
+    }else{
+      compiled.syncTokens(state);
+      for (unsigned int p = 0; p < state.tokens.size(); ++p){
+        bytes += printf("%lli\t", state.tokens[p]);
+      }
+    }
+  }else if (cellnames.size()){
     std::map<std::string, unsigned int>::iterator nIter;
     for (nIter = cellnames.begin(); nIter != cellnames.end(); nIter++){
-      printf("%llu\t", marking[nIter->second]);
+      bytes += printf("%llu\t", marking[nIter->second]);
     }
   }else{
     std::map<unsigned long long, unsigned long long>::iterator i;
     for (i = marking.begin(); i != marking.end(); i++){
-      printf("%lli\t", i->second);
+      bytes += printf("%lli\t", i->second);
     }
   }
-  printf("\n");
+  bytes += printf("\n");
+  stats.phase(PHASE_OUTPUT, phaseStart);
+  return bytes;
 }
 
 /// \brief Prints the header for states, separated by tabs, followed by a newline.
 /// 
 /// The cellnames argument contains a map from place names to place IDs.
 /// If cellnames is empty, prints headers for all places.
-void PetriNet::printStateHeader(std::map<std::string, unsigned int> & cellnames){
+/// Returns the amount of bytes printed.
+unsigned int PetriNet::printStateHeader(std::map<std::string, unsigned int> & cellnames){
+  unsigned int bytes = 0;
   if (cellnames.size()){
     std::map<std::string, unsigned int>::iterator nIter;
     for (nIter = cellnames.begin(); nIter != cellnames.end(); nIter++){
-      printf("%s\t", nIter->first.c_str());
+      bytes += printf("%s\t", nIter->first.c_str());
     }
   }else{
     std::map<unsigned long long, unsigned long long>::iterator i;
     for (i = marking.begin(); i != marking.end(); i++){
-      printf("%s\t", places[i->first].c_str());
+      bytes += printf("%s\t", places[i->first].c_str());
     }
   }
-  printf("\n");
+  bytes += printf("\n");
+  return bytes;
 }
 
+/// \brief Returns z such that a standard normal value lies within -z and z with the given probability.
+static double normalQuantile(double confidence){
+  //The two-sided tail erfc(z / sqrt(2)) falls monotonically from 1 at zero, so bisect on it
+  double lo = 0, hi = 40;
+  for (int i = 0; i < 200; ++i){
+    double mid = (lo + hi) / 2;
+    if (erfc(mid / sqrt(2.0)) > 1 - confidence){
+      lo = mid;
+    }else{
+      hi = mid;
+    }
+  }
+  return (lo + hi) / 2;
+}
+
+/// \brief Prints a line per replica: replica number, seed, steps and the marking of the places in cellnames, or all places.
+static void printReplicas(PetriCompiled & C, std::vector<PetriReplica> & results, unsigned int first, std::map<std::string, unsigned int> & cellnames){
+  for (unsigned int r = 0; r < results.size(); ++r){
+    PetriReplica & R = results[r];
+    printf("%u\t%llu\t%llu\t", first + r, R.seed, R.steps);
+    if (cellnames.size()){
+      std::map<std::string, unsigned int>::iterator nIter;
+      for (nIter = cellnames.begin(); nIter != cellnames.end(); nIter++){
+        unsigned int p = C.placeIndex(nIter->second);
+        printf("%llu\t", (p < R.tokens.size()) ? R.tokens[p] : 0ull);
+      }
+    }else{
+      for (unsigned int p = 0; p < R.tokens.size(); ++p){printf("%lli\t", R.tokens[p]);}
+    }
+    printf("\n");
+  }
+}
+
+/// \brief Runs replicas of the net from the initial marking, with seeds firstSeed, firstSeed + 1 and so on, and prints their final markings.
+///
+/// Every replica stops when no transitions are enabled or after maxSteps steps, 0 meaning no limit, and ends exactly as a single run with its seed would.
+/// Prints a header followed by a line per replica, in replica order: replica number, seed, steps and the marking of the places in cellnames, or all places.
+/// The lockstep engine single steps replicas together, other compiled engines run them one at a time.
+/// Replicas are spread over the given amount of threads, which take over each other's work, see PetriEnsemble::run.
+/// With numa, the threads are placed on the NUMA nodes of the machine, each node with its own copy of the compiled net.
+///
+/// When rule has targets, replicas run in waves of rule.wave, and the run stops after the first wave at which the confidence
+/// interval of the mean final (or time-averaged) marking of every target place is no wider than its target, with replicas as the budget.
+/// The stopping point only depends on the replica results, never on the amount of threads.
+/// Thread placement and scheduling counts are only reported for the first wave, and widened token counts once at the end.
+/// Returns false if the net was not compiled, the step mode is not supported or a target place does not exist.
+bool PetriNet::runEnsemble(int stepMode, unsigned int replicas, unsigned long long firstSeed, unsigned long long maxSteps, unsigned int threads, bool numa, PetriStopRule & rule, std::map<std::string, unsigned int> & cellnames){
+  if (engine == ENGINE_MAP || !engine){
+    std::cerr << "Ensembles need a compiled engine. Cancelling run." << std::endl;
+    return false;
+  }
+  if (stepMode != SINGLE_STEP && stepMode != MAX_AUTOCON_STEP){
+    std::cerr << "Step type not implemented. Cancelling run." << std::endl;
+    return false;
+  }
+  std::vector<std::string> targetNames;
+  std::vector<unsigned int> targetPlaces;
+  std::vector<double> targetWidths;
+  for (std::map<std::string, double>::iterator it = rule.targets.begin(); it != rule.targets.end(); it++){
+    unsigned int p = compiled.placeIndex(findPlace(it->first));
+    if (p >= compiled.placeIds.size()){
+      std::cerr << "Target place " << it->first << " does not exist. Cancelling run." << std::endl;
+      return false;
+    }
+    targetNames.push_back(it->first);
+    targetPlaces.push_back(p);
+    targetWidths.push_back(it->second);
+  }
+  std::vector<unsigned int> tracked;
+  if (rule.timeAverage){tracked = targetPlaces;}
+  double z = normalQuantile(rule.confidence);
+  std::vector<PetriEstimate> estimates(targetPlaces.size());
+  bool lockstep = (engine == ENGINE_LOCKSTEP && stepMode == SINGLE_STEP);
+  if (engine == ENGINE_LOCKSTEP && !lockstep){fprintf(stderr, "The lockstep engine only steps single steps together, running replicas one at a time\n");}
+  if (threads > 1 && compiled.adaptiveScans){
+    //Adaptive arc ordering changes the compiled net while counting, which threads cannot share
+    fprintf(stderr, "Arc order is still adapting, running replicas on a single thread\n");
+    threads = 1;
+  }
+  printf("replica\tseed\tsteps\t");
+  printStateHeader(cellnames);
+  unsigned int wave = (targetPlaces.size() && rule.wave) ? rule.wave : replicas;
+  unsigned int done = 0;
+  unsigned int widenedReplicas = 0, widest = 0;
+  bool met = false;
+  while (done < replicas && !met){
+    unsigned int count = (replicas - done < wave) ? replicas - done : wave;
+    std::vector<PetriReplica> results(count);
+    for (unsigned int r = 0; r < count; ++r){results[r].seed = firstSeed + done + r;}
+    {
+      TimelineSpan span("ensemble");
+      PetriEnsemble::run(compiled, stepMode, lockstep, threads, numa, tracked, results, maxSteps, stats, !done);
+    }
+    printReplicas(compiled, results, done, cellnames);
+    for (unsigned int r = 0; r < count; ++r){
+      if (!results[r].widened){continue;}
+      widenedReplicas++;
+      if (results[r].width > widest){widest = results[r].width;}
+    }
+    fflush(stdout);
+    done += count;
+    if (!targetPlaces.size()){continue;}
+    met = (done >= ENSEMBLE_MIN_REPLICAS);
+    for (unsigned int i = 0; i < targetPlaces.size(); ++i){
+      for (unsigned int r = 0; r < count; ++r){
+        PetriReplica & R = results[r];
+        estimates[i].add(rule.timeAverage ? R.sums[i] / (R.steps + 1) : (double)R.tokens[targetPlaces[i]]);
+      }
+      if (estimates[i].halfWidth(z) > targetWidths[i]){met = false;}
+    }
+  }
+  if (widenedReplicas){fprintf(stderr, "Token counts of %u replicas no longer fit, widened up to %u bits\n", widenedReplicas, widest);}
+  if (!targetPlaces.size()){return true;}
+  if (met){
+    fprintf(stderr, "Targets met after %u of %u replicas\n", done, replicas);
+  }else{
+    fprintf(stderr, "Targets not met after all %u replicas\n", replicas);
+  }
+  for (unsigned int i = 0; i < targetPlaces.size(); ++i){
+    fprintf(stderr, "%s %s: %g +- %g (target +- %g, n=%llu, %g%% confidence)\n", targetNames[i].c_str(), rule.timeAverage ? "time average" : "final", estimates[i].mean, estimates[i].halfWidth(z), targetWidths[i], estimates[i].count, rule.confidence * 100);
+  }
+  return true;
+}
+
+/// \brief Seeds the random number generator used for stepping.
+void PetriNet::seed(unsigned long long s){
+  state.rng.seed(s);
+}
+
+/// Magic bytes at the start of every checkpoint file, including the format version.
+#define CHECKPOINT_MAGIC "PCCKPT01"
+
+/// \brief Writes a single unsigned 64-bit value in little-endian byte order.
+static bool writeU64(FILE * F, unsigned long long v){
+  unsigned char buf[8];
+  for (int i = 0; i < 8; ++i){buf[i] = (v >> (8*i)) & 0xFF;}
+  return fwrite(buf, 8, 1, F) == 1;
+}
+
+/// \brief Reads a single unsigned 64-bit value in little-endian byte order.
+static bool readU64(FILE * F, unsigned long long & v){
+  unsigned char buf[8];
+  if (fread(buf, 8, 1, F) != 1){return false;}
+  v = 0;
+  for (int i = 0; i < 8; ++i){v |= ((unsigned long long)buf[i]) << (8*i);}
+  return true;
+}
+
+/// \brief Writes a binary snapshot of the marking, random number generator, step counter and output position to the given file.
+///
+/// The snapshot is first written to a temporary file, which is then renamed over the given file.
+/// This way, a crash during writing never destroys the previous checkpoint.
+/// Returns true on success, false on failure.
+bool PetriNet::saveCheckpoint(std::string filename, int stepMode, unsigned long long steps, long long outputPos){
+  TimelineSpan span("checkpoint");
+  std::string tmpName = filename + ".tmp";
+  FILE * F = fopen(tmpName.c_str(), "wb");
+  if (!F){
+    fprintf(stderr, "Error: Could not write checkpoint %s\n", tmpName.c_str());
+    return false;
+  }
+  bool ok = (fwrite(CHECKPOINT_MAGIC, 8, 1, F) == 1);
+  ok = ok && writeU64(F, stepMode);
+  ok = ok && writeU64(F, steps);
+  ok = ok && writeU64(F, (unsigned long long)outputPos);
+  for (int i = 0; i < 4; ++i){ok = ok && writeU64(F, state.rng.state[i]);}
+  //Compiled engines keep the marking in state.tokens, in the same order as the marking map
+  if (engine != ENGINE_MAP && engine){
+    compiled.syncTokens(state);
+    for (unsigned int p = 0; p < state.tokens.size(); ++p){marking[compiled.placeIds[p]] = state.tokens[p];}
+  }
+  ok = ok && writeU64(F, marking.size());
+  std::map<unsigned long long, unsigned long long>::iterator i;
+  for (i = marking.begin(); i != marking.end(); i++){
+    ok = ok && writeU64(F, i->first);
+    ok = ok && writeU64(F, i->second);
+  }
+  ok = (fclose(F) == 0) && ok;
+  if (!ok || rename(tmpName.c_str(), filename.c_str())){
+    fprintf(stderr, "Error: Could not write checkpoint %s\n", filename.c_str());
+    remove(tmpName.c_str());
+    return false;
+  }
+  return true;
+}
+
+/// \brief Restores a binary snapshot written by saveCheckpoint.
+///
+/// The checkpoint must have been written by a run of the same net in the same step mode.
+/// Returns true on success, false if the file could not be read or does not belong to this net.
+bool PetriNet::loadCheckpoint(std::string filename, int stepMode, unsigned long long & steps, long long & outputPos){
+  TimelineSpan span("resume");
+  FILE * F = fopen(filename.c_str(), "rb");
+  if (!F){
+    fprintf(stderr, "Error: Could not read checkpoint %s\n", filename.c_str());
+    return false;
+  }
+  char magic[8];
+  unsigned long long mode, pos, count, rngState[4];
+  bool ok = (fread(magic, 8, 1, F) == 1) && !memcmp(magic, CHECKPOINT_MAGIC, 8);
+  ok = ok && readU64(F, mode) && readU64(F, steps) && readU64(F, pos);
+  for (int i = 0; i < 4; ++i){ok = ok && readU64(F, rngState[i]);}
+  ok = ok && readU64(F, count);
+  if (!ok){
+    fprintf(stderr, "Error: %s is not a valid checkpoint file\n", filename.c_str());
+    fclose(F);
+    return false;
+  }
+  if (mode != (unsigned long long)stepMode || count != marking.size()){
+    fprintf(stderr, "Error: Checkpoint %s was made with a different net or step mode\n", filename.c_str());
+    fclose(F);
+    return false;
+  }
+  std::map<unsigned long long, unsigned long long> newMarking;
+  for (unsigned long long n = 0; ok && n < count; ++n){
+    unsigned long long id = 0, tokens = 0;
+    ok = readU64(F, id) && readU64(F, tokens) && marking.count(id);
+    newMarking[id] = tokens;
+  }
+  fclose(F);
+  if (!ok){
+    fprintf(stderr, "Error: Checkpoint %s was made with a different net or is damaged\n", filename.c_str());
+    return false;
+  }
+  marking = newMarking;
+  if (engine != ENGINE_MAP && engine){
+    for (unsigned int p = 0; p < state.tokens.size(); ++p){state.tokens[p] = marking[compiled.placeIds[p]];}
+    compiled.loadTokens(state);
+  }
+  for (int i = 0; i < 4; ++i){state.rng.state[i] = rngState[i];}
+  outputPos = (long long)pos;
+  return true;
+}
@@ -10,13 +10,10 @@
 #include <set>
 #include <string>
 #include "tinyxml.h"
-
-//DEBUG levels:
-// 10 = All load stages at full verbosity
-//  9 = Arc combining
-//  8 = Range function evaluations
-//  5 = Enabled transition counts during stepping
-//  4 = Chosen transition during stepping
+#include "petristats.h"
+#include "petrirandom.h"
+#include "petriengine.h"
+#include "petriensemble.h"
 
 #define SINGLE_STEP 1 ///< Single step mode
 #define CONCUR_STEP 2 ///< Concurrent step mode
@@ -24,6 +21,27 @@
 #define MAX_CONCUR_STEP 4 ///< Maximally concurrent step mode
 #define MAX_AUTOCON_STEP 5 ///< Maximally auto-concurrent step mode
 
+#define ENGINE_MAP 1 ///< Reference engine, stepping directly on the maps built during net load
+#define ENGINE_SIMD 2 ///< Structure-of-arrays arcs, enabledness evaluated with the widest SIMD instructions the CPU supports
+#define ENGINE_BITSET 3 ///< Marking as a bitset and arcs as bit masks, for 1-safe nets. Falls back to the simd engine otherwise.
+#define ENGINE_KINDS 4 ///< Arcs grouped by kind, each kind checked and fired by its own specialised kernel
+#define ENGINE_COUNTERS 5 ///< Unsatisfied arcs counted per transition, updated only for arcs on places that changed
+#define ENGINE_LOCKSTEP 6 ///< Ensemble replicas single stepped together in SIMD lanes, see PetriEnsemble. Single runs step as on the simd engine.
+
+int parseStepMode(std::string name);
+std::string stepModeName(int stepMode);
+int parseEngine(std::string name);
+std::string engineName(int engine);
+
+
+/// Edge types, in the order of the Snoopy edge classes they are read from by parseEdges.
+enum edgeType{
+  EDGE_NORMAL,
+  EDGE_ACTIVATOR,
+  EDGE_INHIBITOR,
+  EDGE_RESET,
+  EDGE_EQUAL
+};
 
 /// Since infinity is not representable as a number, the constant 0xFFFFFFFFFFFFFFFFull is used to represent infinity.
 #define INFTY 0xFFFFFFFFFFFFFFFFull
@@ -43,6 +61,10 @@ class PetriArc{
     bool rangeFunction(unsigned long long);
     void effectFunction(unsigned long long &);
     void combine(PetriArc param);
+    bool isSatisfiable();
+    void traceWords(unsigned long long * words);
+    bool operator==(const PetriArc & rhs) const;
+    bool operator<(const PetriArc & rhs) const;
     std::string label();
 };
 
@@ -58,20 +80,36 @@ class PetriSuperTrans{
 class PetriNet{
   public:
     PetriNet(std::string XML);
+    ~PetriNet();
+    void compile(int useEngine, int useIsa = 0, unsigned int useThreads = 1, int useSplit = SPLIT_NONE, unsigned int useWidth = 64);
+    void adaptArcOrder(unsigned long long warmupScans, std::string saveFile);
+    bool loadArcProfile(std::string filename);
     bool calculateStep(int stepMode);
-    void printStateHeader(std::map<std::string, unsigned int> & cellnames);
-    void printState(std::map<std::string, unsigned int> & cellnames);
+    bool runEnsemble(int stepMode, unsigned int replicas, unsigned long long firstSeed, unsigned long long maxSteps, unsigned int threads, bool numa, PetriStopRule & rule, std::map<std::string, unsigned int> & cellnames);
+    unsigned int printStateHeader(std::map<std::string, unsigned int> & cellnames);
+    unsigned int printState(std::map<std::string, unsigned int> & cellnames);
     bool isEnabled(unsigned int T);
+    std::set<unsigned long long>::iterator pickTransition(std::set<unsigned long long> & enabled);
     unsigned int findPlace(std::string placename);
+    void seed(unsigned long long s);
+    bool saveCheckpoint(std::string filename, int stepMode, unsigned long long steps, long long outputPos);
+    bool loadCheckpoint(std::string filename, int stepMode, unsigned long long & steps, long long & outputPos);
+    bool generateCode(std::string filename, std::map<std::string, unsigned int> & cellnames, int stepMode, unsigned int printInterval);
+    PetriStats stats;///< Runtime counters, updated while stepping
 private:
+    int engine;///< Engine selected by compile()
+    PetriCompiled compiled;///< Flat representation of the net, for all engines except the map engine
+    PetriState state;///< Random number generator, plus the marking and scratch space of compiled engines
     std::map<unsigned long long, std::string> places;///< Human readable names for places
-    std::map<unsigned long long, unsigned long long> marking;///< Markings for places
+    std::map<unsigned long long, unsigned long long> marking;///< Markings for places. Compiled engines use state.tokens instead while stepping.
     std::map<unsigned long long, std::string> transitions;///< Human readable names for transitions
-    std::map<unsigned long long, std::map<unsigned long long, PetriArc> > arcs;///<All arcs, in the format: arcs[transition][place]
+    std::map<unsigned long long, std::map<unsigned long long, PetriArc> > arcs;///<All arcs, in the format: arcs[transition][place]. Emptied by compile for compiled engines.
+    std::map<unsigned long long, unsigned long long> weights;///< Amount of original transitions merged into each transition, if more than one.
     void parseNodes(TiXmlNode * N);
     void parseEdges(TiXmlNode * N);
     void addPlace(TiXmlNode * N);
     void addTransition(TiXmlNode * N);
     void addEdge(TiXmlNode * N, unsigned int E);
+    void reduceTransitions();
 };//PetriNet
 
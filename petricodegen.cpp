@@ -0,0 +1,263 @@
+/// \file petricodegen.cpp
+/// \brief PetriCalc code generator, writing a net as a specialised C++ simulator.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+///
+/// The generated simulator has every arc bound, effect and place index of the net baked in as constants:
+/// one straight-line enabledness expression per transition, and one case per transition in the firing and combining switches.
+/// Its driver follows PetriCompiled::step, including every random number it draws, so for the same seed and output places
+/// it prints exactly what PetriCalc prints for the same net.
+
+#include "petricalc.h"
+#include <stdio.h>
+#include <iostream>
+
+/// \brief Returns the given string as a C string literal.
+static std::string cString(const std::string & s){
+  std::string r = "\"";
+  for (unsigned int i = 0; i < s.size(); ++i){
+    char c = s[i];
+    if (c == '"' || c == '\\'){
+      r += '\\';
+      r += c;
+    }else if (c == '\n'){
+      r += "\\n";
+    }else if (c == '\t'){
+      r += "\\t";
+    }else if (c == '%'){
+      r += "%%";
+    }else{
+      r += c;
+    }
+  }
+  return r + "\"";
+}
+
+/// \brief Writes a statement applying effect to m[p], either as setter or as addition.
+static void writeEffect(FILE * F, unsigned int p, long long effect, bool setter){
+  if (setter){
+    fprintf(F, " m[%u] = %lluull;", p, (unsigned long long)effect);
+  }else if (effect < 0){
+    fprintf(F, " m[%u] -= %lluull;", p, 0ull - (unsigned long long)effect);
+  }else if (effect > 0){
+    fprintf(F, " m[%u] += %lluull;", p, (unsigned long long)effect);
+  }
+}
+
+/// \brief Writes a C++ translation unit simulating this net to the given file.
+///
+/// The net must have been compiled for the kinds engine, whose per-kind arcs become the enabledness expressions.
+/// The places in cellnames, or all places if empty, are printed like printState does.
+/// stepMode and printInterval become the defaults of the generated program, which takes the step type and print interval positional arguments of PetriCalc.
+/// Its output places are fixed, so it rejects further positional arguments.
+/// Only single and maximally auto-concurrent stepping are supported, as on the compiled engines.
+/// Returns true on success, false on failure.
+bool PetriNet::generateCode(std::string filename, std::map<std::string, unsigned int> & cellnames, int stepMode, unsigned int printInterval){
+  if (engine != ENGINE_KINDS){
+    std::cerr << "Code generation needs a net compiled for the kinds engine." << std::endl;
+    return false;
+  }
+  if (stepMode != SINGLE_STEP && stepMode != MAX_AUTOCON_STEP){
+    std::cerr << "Code generation only supports single and maxautoconcurrent stepping." << std::endl;
+    return false;
+  }
+  FILE * F = fopen(filename.c_str(), "w");
+  if (!F){
+    std::cerr << "Could not open " << filename << " for writing." << std::endl;
+    return false;
+  }
+  PetriCompiled & C = compiled;
+  unsigned int placeCount = C.placeIds.size(), transitionCount = C.transitionIds.size();
+
+  fprintf(F, "// Generated by PetriCalc, do not edit. Simulates a net of %u places and %u transitions.\n", placeCount, transitionCount);
+  fprintf(F, "// Usage: ./binary [--seed=N] [steptype=%s [print_interval=%u]]\n", stepModeName(stepMode).c_str(), printInterval);
+  fprintf(F, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <time.h>\n#include <unistd.h>\n\n");
+  fprintf(F, "#define PLACES %u\n#define TRANSITIONS %u\n\n", placeCount ? placeCount : 1, transitionCount ? transitionCount : 1);
+
+  //Marking, starting at the initial marking
+  compiled.syncTokens(state);
+  fprintf(F, "static unsigned long long m[PLACES] = {");
+  for (unsigned int p = 0; p < placeCount; ++p){fprintf(F, "%s%lluull", p ? ", " : "", state.tokens[p]);}
+  fprintf(F, "%s};\n", placeCount ? "" : "0");
+  fprintf(F, "static unsigned int enabled[TRANSITIONS];\n");
+  fprintf(F, "static unsigned int enabledCount;\n\n");
+
+  //Random number generator, identical to PetriRandom
+  fprintf(F, "static unsigned long long rng[4];\n\n");
+  fprintf(F, "static void seed(unsigned long long s){\n");
+  fprintf(F, "  for (int i = 0; i < 4; ++i){\n");
+  fprintf(F, "    s += 0x9E3779B97F4A7C15ull;\n");
+  fprintf(F, "    unsigned long long z = s;\n");
+  fprintf(F, "    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;\n");
+  fprintf(F, "    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;\n");
+  fprintf(F, "    rng[i] = z ^ (z >> 31);\n");
+  fprintf(F, "  }\n}\n\n");
+  fprintf(F, "static inline unsigned long long below(unsigned long long n){\n");
+  fprintf(F, "  unsigned long long result = rng[1] * 5;\n");
+  fprintf(F, "  result = ((result << 7) | (result >> 57)) * 9;\n");
+  fprintf(F, "  unsigned long long t = rng[1] << 17;\n");
+  fprintf(F, "  rng[2] ^= rng[0];\n  rng[3] ^= rng[1];\n  rng[1] ^= rng[2];\n  rng[0] ^= rng[3];\n  rng[2] ^= t;\n");
+  fprintf(F, "  rng[3] = (rng[3] << 45) | (rng[3] >> 19);\n");
+  fprintf(F, "  return result %% n;\n}\n\n");
+
+  //Picking, identical to PetriCompiled::pick
+  if (C.weighted){
+    fprintf(F, "static const unsigned long long weight[TRANSITIONS] = {");
+    for (unsigned int t = 0; t < transitionCount; ++t){fprintf(F, "%s%llu", t ? ", " : "", C.weights[t]);}
+    fprintf(F, "};\n\n");
+    fprintf(F, "static inline unsigned int pick(){\n");
+    fprintf(F, "  unsigned long long total = 0;\n");
+    fprintf(F, "  for (unsigned int i = 0; i < enabledCount; ++i){total += weight[enabled[i]];}\n");
+    fprintf(F, "  unsigned long long r = below(total);\n");
+    fprintf(F, "  unsigned int i = 0;\n");
+    fprintf(F, "  for (; i < enabledCount; ++i){\n");
+    fprintf(F, "    if (r < weight[enabled[i]]){break;}\n");
+    fprintf(F, "    r -= weight[enabled[i]];\n");
+    fprintf(F, "  }\n  return i;\n}\n\n");
+  }else{
+    fprintf(F, "static inline unsigned int pick(){return below(enabledCount);}\n\n");
+  }
+
+  //Enabledness: one branchless expression per transition
+  fprintf(F, "static void scan(){\n  unsigned int n = 0;\n");
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    const unsigned int * start = &C.kindStart[t * KIND_COUNT];
+    fprintf(F, "  enabled[n] = %u; n += 1", t);
+    for (unsigned int k = start[KIND_READ]; k < start[KIND_PRODUCE]; ++k){fprintf(F, " & (m[%u] >= %lluull)", C.kindPlace[k], C.kindValue[k]);}
+    for (unsigned int k = start[KIND_INHIBIT]; k < start[KIND_EQUAL]; ++k){fprintf(F, " & (m[%u] <= %lluull)", C.kindPlace[k], C.kindValue[k]);}
+    for (unsigned int k = start[KIND_EQUAL]; k < start[KIND_GENERAL]; ++k){fprintf(F, " & (m[%u] == %lluull)", C.kindPlace[k], C.kindValue[k]);}
+    for (unsigned int k = start[KIND_GENERAL]; k < start[KIND_COUNT]; ++k){
+      unsigned int a = C.kindValue[k];
+      fprintf(F, " & (m[%u] - %lluull <= %lluull)", C.kindPlace[k], C.arcLow(a), C.arcSpan(a));
+    }
+    fprintf(F, ";\n");
+  }
+  fprintf(F, "  enabledCount = n;\n}\n\n");
+
+  //Firing a single transition
+  fprintf(F, "static void fire(unsigned int t){\n  switch (t){\n");
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    const unsigned int * start = &C.kindStart[t * KIND_COUNT];
+    fprintf(F, "    case %u:", t);
+    for (unsigned int k = start[KIND_CONSUME]; k < start[KIND_INHIBIT]; ++k){writeEffect(F, C.kindPlace[k], C.kindEffect[k], k >= start[KIND_RESET]);}
+    for (unsigned int k = start[KIND_GENERAL]; k < start[KIND_COUNT]; ++k){
+      unsigned int a = C.kindValue[k];
+      writeEffect(F, C.kindPlace[k], C.arcEffect[a], C.arcSetter[a]);
+    }
+    fprintf(F, " break;\n");
+  }
+  fprintf(F, "  }\n}\n\n");
+
+  //Maximal auto-concurrent steps: the super-transition, following PetriCompiled::canAdd, add and fireSuper
+  fprintf(F, "static unsigned long long superUsed[PLACES], superAdded[PLACES];\n");
+  fprintf(F, "static long long superEffect[PLACES];\n");
+  fprintf(F, "static unsigned char superSetter[PLACES], touched[PLACES];\n");
+  fprintf(F, "static unsigned int touchedList[PLACES], touchedCount;\n\n");
+  fprintf(F, "static inline void touch(unsigned int p){\n");
+  fprintf(F, "  if (!touched[p]){\n    touched[p] = 1;\n    touchedList[touchedCount++] = p;\n  }\n}\n\n");
+  fprintf(F, "static bool canAdd(unsigned int t){\n  switch (t){\n");
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    fprintf(F, "    case %u: return true", t);
+    for (unsigned int a = C.arcStart[t]; a < C.arcStart[t + 1]; ++a){
+      if (C.arcUsed[a]){fprintf(F, " && superUsed[%u] + %lluull <= m[%u]", C.arcPlace[a], C.arcUsed[a], C.arcPlace[a]);}
+    }
+    fprintf(F, ";\n");
+  }
+  fprintf(F, "  }\n  return false;\n}\n\n");
+  fprintf(F, "static void add(unsigned int t){\n  switch (t){\n");
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    fprintf(F, "    case %u:", t);
+    for (unsigned int a = C.arcStart[t]; a < C.arcStart[t + 1]; ++a){
+      unsigned int p = C.arcPlace[a];
+      fprintf(F, " touch(%u);", p);
+      if (C.arcUsed[a]){fprintf(F, " superUsed[%u] += %lluull;", p, C.arcUsed[a]);}
+      if (C.arcEffect[a]){fprintf(F, " superEffect[%u] += %lldll;", p, C.arcEffect[a]);}
+      if (C.arcAdded[a]){fprintf(F, " superAdded[%u] += %lldll;", p, C.arcAdded[a]);}
+      if (C.arcSetter[a]){fprintf(F, " superSetter[%u] = 1;", p);}
+    }
+    fprintf(F, " break;\n");
+  }
+  fprintf(F, "  }\n}\n\n");
+  fprintf(F, "static void fireSuper(){\n");
+  fprintf(F, "  for (unsigned int i = 0; i < touchedCount; ++i){\n");
+  fprintf(F, "    unsigned int p = touchedList[i];\n");
+  fprintf(F, "    if (superSetter[p]){\n      m[p] = superAdded[p];\n    }else{\n      m[p] += superEffect[p];\n    }\n");
+  fprintf(F, "    superUsed[p] = 0;\n    superEffect[p] = 0;\n    superAdded[p] = 0;\n    superSetter[p] = 0;\n    touched[p] = 0;\n");
+  fprintf(F, "  }\n  touchedCount = 0;\n}\n\n");
+
+  //Output, identical to printStateHeader and printState
+  fprintf(F, "static void printHeader(){\n  fputs(");
+  std::string header;
+  if (cellnames.size()){
+    std::map<std::string, unsigned int>::iterator nIter;
+    for (nIter = cellnames.begin(); nIter != cellnames.end(); nIter++){header += nIter->first + "\t";}
+  }else{
+    for (unsigned int p = 0; p < placeCount; ++p){header += places[C.placeIds[p]] + "\t";}
+  }
+  fprintf(F, "%s, stdout);\n}\n\n", cString(header + "\n").c_str());
+  fprintf(F, "static void printState(){\n  printf(\"");
+  std::string args;
+  char buf[64];
+  if (cellnames.size()){
+    std::map<std::string, unsigned int>::iterator nIter;
+    for (nIter = cellnames.begin(); nIter != cellnames.end(); nIter++){
+      unsigned int p = C.placeIndex(nIter->second);
+      if (p < placeCount){
+        fprintf(F, "%%llu\\t");
+        snprintf(buf, sizeof(buf), ", m[%u]", p);
+        args += buf;
+      }else{
+        fprintf(F, "0\\t");
+      }
+    }
+  }else{
+    for (unsigned int p = 0; p < placeCount; ++p){
+      fprintf(F, "%%lli\\t");
+      snprintf(buf, sizeof(buf), ", (long long)m[%u]", p);
+      args += buf;
+    }
+  }
+  fprintf(F, "\\n\"%s);\n}\n\n", args.c_str());
+
+  //Driver, following the main loop of PetriCalc and PetriCompiled::step
+  fprintf(F, "int main(int argc, char ** argv){\n");
+  fprintf(F, "  bool single = %s;\n", (stepMode == SINGLE_STEP) ? "true" : "false");
+  fprintf(F, "  unsigned long long printInterval = %u, steps = 0, lastSteps = 0;\n", printInterval);
+  fprintf(F, "  seed(getpid());\n");
+  fprintf(F, "  int pos = 0;\n");
+  fprintf(F, "  for (int i = 1; i < argc; ++i){\n");
+  fprintf(F, "    if (!strncmp(argv[i], \"--seed=\", 7)){\n      seed(strtoull(argv[i] + 7, 0, 10));\n      continue;\n    }\n");
+  fprintf(F, "    if (pos == 0){\n");
+  fprintf(F, "      if (!strcmp(argv[i], \"single\")){\n        single = true;\n      }else if (!strcmp(argv[i], \"maxautoconcurrent\")){\n        single = false;\n      }else{\n");
+  fprintf(F, "        fprintf(stderr, \"steptype must be one of: single, maxautoconcurrent. Aborting.\\n\");\n        return 1;\n      }\n");
+  fprintf(F, "    }\n");
+  fprintf(F, "    if (pos == 1){\n      printInterval = strtoull(argv[i], 0, 10);\n");
+  fprintf(F, "      if (printInterval < 1){\n        fprintf(stderr, \"print_interval must be >= 1. Aborting.\\n\");\n        return 1;\n      }\n    }\n");
+  fprintf(F, "    if (pos > 1){\n      fprintf(stderr, \"Output places are fixed when generating, only steptype and print_interval can be given. Aborting.\\n\");\n      return 1;\n    }\n");
+  fprintf(F, "    pos++;\n  }\n");
+  fprintf(F, "  time_t startTime = time(0), lastTime = startTime;\n");
+  fprintf(F, "  printHeader();\n  printState();\n");
+  fprintf(F, "  while (true){\n");
+  fprintf(F, "    scan();\n");
+  fprintf(F, "    if (!enabledCount){break;}\n");
+  fprintf(F, "    if (single){\n      fire(enabled[pick()]);\n    }else{\n");
+  fprintf(F, "      add(enabled[pick()]);\n");
+  fprintf(F, "      while (enabledCount){\n");
+  fprintf(F, "        unsigned int i = pick(), t = enabled[i];\n");
+  fprintf(F, "        if (canAdd(t)){\n          add(t);\n        }else{\n");
+  fprintf(F, "          memmove(enabled + i, enabled + i + 1, (enabledCount - i - 1) * sizeof(unsigned int));\n");
+  fprintf(F, "          enabledCount--;\n        }\n      }\n");
+  fprintf(F, "      fireSuper();\n    }\n");
+  fprintf(F, "    steps++;\n");
+  fprintf(F, "    if (steps %% printInterval == 0){printState();}\n");
+  fprintf(F, "    time_t now = time(0);\n");
+  fprintf(F, "    if (now > lastTime){\n");
+  fprintf(F, "      fprintf(stderr, \"Calculated %%llu steps, avg: %%gs/s, cur:%%g s/s...\\n\", steps, steps / (double)(now - startTime), (steps - lastSteps) / (double)(now - lastTime));\n");
+  fprintf(F, "      lastTime = now;\n      lastSteps = steps;\n    }\n");
+  fprintf(F, "  }\n  return 0;\n}\n");
+
+  if (fclose(F)){
+    std::cerr << "Could not write " << filename << "." << std::endl;
+    return false;
+  }
+  return true;
+}
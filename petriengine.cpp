@@ -0,0 +1,1549 @@
+/// \file petriengine.cpp
+/// \brief PetriCalc compiled engine implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petricalc.h"
+#include "petritrace.h"
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+/// \brief Returns the widest instruction set supported by both this build and the CPU.
+int detectIsa(){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")){return ISA_AVX512;}
+  if (__builtin_cpu_supports("avx2")){return ISA_AVX2;}
+#endif
+  return ISA_SCALAR;
+}
+
+/// \brief Returns the instruction set constant for the given command line name, or 0 if unknown.
+int parseIsa(std::string name){
+  if (name == "scalar"){return ISA_SCALAR;}
+  if (name == "avx2"){return ISA_AVX2;}
+  if (name == "avx512"){return ISA_AVX512;}
+  return 0;
+}
+
+/// \brief Returns the command line name of the given instruction set constant.
+std::string isaName(int isa){
+  switch (isa){
+    case ISA_SCALAR: return "scalar";
+    case ISA_AVX2: return "avx2";
+    case ISA_AVX512: return "avx512";
+  }
+  return "unknown";
+}
+
+/// \brief Creates an empty state. Call PetriCompiled::initState before use.
+PetriState::PetriState(){
+  enabledCount = 0;
+  width = 64;
+  widened = 0;
+  bitsActive = false;
+  pool = 0;
+}
+
+/// \brief Creates an empty compiled net. Call build() before use.
+PetriCompiled::PetriCompiled(){
+  engine = 0;
+  isa = ISA_SCALAR;
+  weighted = false;
+  bitsSupported = false;
+  componentCount = 0;
+  split = SPLIT_NONE;
+  adaptiveScans = 0;
+  width = 64;
+  conserving = false;
+  for (unsigned int k = 0; k < KIND_COUNT; ++k){kindTotal[k] = 0;}
+}
+
+/// \brief Converts the maps of a loaded and reduced net into flat arrays.
+///
+/// Places that only appear in arcs are added to the marking, as the map engine would on first use.
+/// If useIsa is 0 or not supported by the CPU, the widest supported instruction set is used instead.
+/// If useThreads is more than 1 and the net is large enough, transitions are split into chunks of about SCAN_CHUNK_ARCS arcs that can be scanned in parallel.
+void PetriCompiled::build(int useEngine, int useIsa, unsigned int useThreads, std::map<unsigned long long, unsigned long long> & marking, std::map<unsigned long long, std::map<unsigned long long, PetriArc> > & arcs, std::map<unsigned long long, unsigned long long> & weights, std::map<unsigned long long, std::string> & names){
+  engine = useEngine;
+  isa = detectIsa();
+  if (useIsa && useIsa < isa){isa = useIsa;}
+  std::map<unsigned long long, std::map<unsigned long long, PetriArc> >::iterator T;
+  std::map<unsigned long long, PetriArc>::iterator A;
+  for (T = arcs.begin(); T != arcs.end(); T++){
+    for (A = T->second.begin(); A != T->second.end(); A++){
+      if (!marking.count(A->first)){marking[A->first] = 0;}
+    }
+  }
+  std::map<unsigned long long, unsigned long long>::iterator M;
+  for (M = marking.begin(); M != marking.end(); M++){
+    placeIndices[M->first] = placeIds.size();
+    placeIds.push_back(M->first);
+    initialTokens.push_back(M->second);
+  }
+  arcStart.push_back(0);
+  for (T = arcs.begin(); T != arcs.end(); T++){
+    if (!T->second.size()){continue;}
+    transitionIds.push_back(T->first);
+    transitionNames.push_back(names[T->first].c_str());
+    unsigned long long w = weights.count(T->first) ? weights[T->first] : 1;
+    if (w != 1){weighted = true;}
+    this->weights.push_back(w);
+    for (A = T->second.begin(); A != T->second.end(); A++){
+      PetriArc & arc = A->second;
+      unsigned long long low = (arc.rangeUsed > arc.rangeLow) ? arc.rangeUsed : arc.rangeLow;
+      arcPlace.push_back(placeIndices[A->first]);
+      if (arc.rangeHigh == INFTY && low < ARC_SPAN_WIDE){
+        arcLow32.push_back(low);
+        arcSpan32.push_back(ARC_SPAN_OPEN);
+      }else if (low <= 0xFFFFFFFFull && arc.rangeHigh - low < ARC_SPAN_WIDE){
+        arcLow32.push_back(low);
+        arcSpan32.push_back(arc.rangeHigh - low);
+      }else{
+        arcLow32.push_back(arcWideLow.size());
+        arcSpan32.push_back(ARC_SPAN_WIDE);
+        arcWideArc.push_back(arcPlace.size() - 1);
+        arcWideLow.push_back(low);
+        arcWideSpan.push_back(arc.rangeHigh - low);
+      }
+      arcUsed.push_back(arc.rangeUsed);
+      arcEffect.push_back(arc.effect);
+      arcAdded.push_back(arc.effectAdded);
+      arcSetter.push_back(arc.effectSetter);
+    }
+    arcStart.push_back(arcPlace.size());
+  }
+  chunkStart.push_back(0);
+  if (useThreads > 1 && arcPlace.size() >= PARALLEL_MIN_ARCS){
+    for (unsigned int t = 0; t < transitionIds.size(); ++t){
+      if (arcStart[t] - arcStart[chunkStart.back()] >= SCAN_CHUNK_ARCS){chunkStart.push_back(t);}
+    }
+  }
+  chunkStart.push_back(transitionIds.size());
+  //Every chunk evaluates its range functions into its own words, so chunks never share a word
+  chunkBitWord.push_back(0);
+  for (unsigned int c = 0; c + 1 < chunkStart.size(); ++c){
+    chunkBitWord.push_back(chunkBitWord.back() + (arcStart[chunkStart[c + 1]] - arcStart[chunkStart[c]] + 63) / 64 + 1);
+  }
+  if (engine == ENGINE_BITSET){buildBits();}
+  if (engine == ENGINE_KINDS){buildKinds();}
+  if (engine == ENGINE_COUNTERS){buildCounters();}
+}
+
+/// \brief Builds the bit masks used by the bitset engine.
+///
+/// In a 1-safe marking every place holds 0 or 1 tokens, so each arc reduces to a few bits:
+/// whether the place must be marked (pre) or empty (inhib), whether its token is used, consumed or a token is added, and whether the arc is a setter.
+/// Firing then gives m' = a for set places and m' = (m & ~c) | a for other places, which is unsafe when two tokens are added or a token is added to a kept one.
+/// Arcs of a transition are grouped per 64-bit marking word, so a transition needs one mask entry per word it touches.
+/// If an arc has no such form, bitsSupported stays false and the net is simulated on tokens instead.
+void PetriCompiled::buildBits(){
+  bitsSupported = true;
+  bitStart.push_back(0);
+  for (unsigned int t = 0; t < transitionIds.size(); ++t){
+    bool dead = false, unsafe = false, supported = true;
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+      unsigned int p = arcPlace[a];
+      unsigned int w = p >> 6;
+      unsigned long long bit = 1ull << (p & 63);
+      if (bitWord.size() == bitStart[t] || bitWord.back() != w){
+        bitWord.push_back(w);
+        bitPre.push_back(0);
+        bitInhib.push_back(0);
+        bitUsed.push_back(0);
+        bitConsume.push_back(0);
+        bitAdd.push_back(0);
+        bitSetter.push_back(0);
+      }
+      unsigned long long high = arcLow(a) + arcSpan(a);
+      bool zero = (arcLow(a) == 0), one = (arcLow(a) <= 1 && high >= 1);
+      if (!zero && !one){dead = true;}
+      if (one && !zero){bitPre.back() |= bit;}
+      if (zero && !one){bitInhib.back() |= bit;}
+      if (arcUsed[a]){bitUsed.back() |= bit;}
+      long long added = arcAdded[a], consumed = arcAdded[a] - arcEffect[a];
+      if (added >= 2){unsafe = true;}
+      if (added == 1){bitAdd.back() |= bit;}
+      if (arcSetter[a]){
+        bitSetter.back() |= bit;
+        continue;
+      }
+      if (consumed == 1 && arcUsed[a] && !zero){
+        bitConsume.back() |= bit;
+      }else if (consumed != 0){
+        supported = false;
+      }
+    }
+    if (!dead && !supported){bitsSupported = false;}
+    bitDead.push_back(dead);
+    bitUnsafe.push_back(unsafe);
+    bitStart.push_back(bitWord.size());
+  }
+}
+
+/// \brief Sorts the arcs of every transition by kind, and groups the transitions of every scan chunk by the checks they need.
+///
+/// Most arcs come straight from a single Snoopy edge and need only one comparison, or none at all.
+/// Arcs that were combined into something else during load, or have no simpler form, become general arcs.
+/// Arcs without check or effect are left out.
+void PetriCompiled::buildKinds(){
+  unsigned int transitionCount = transitionIds.size(), chunks = chunkStart.size() - 1, chunk = 0;
+  std::vector<std::vector<unsigned int> > groups(chunks * CHECK_COMBINATIONS);
+  kindChecks.assign(chunks, 0);
+  conserving = true;
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    while (t >= chunkStart[chunk + 1]){chunk++;}
+    std::vector<std::pair<unsigned int, unsigned int> > sorted;
+    long long produced = 0;
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+      //Transitions that never add tokens in total let the automatic width start from the total marking
+      if (arcSetter[a]){
+        if (arcEffect[a] > 0){conserving = false;}
+      }else{
+        produced += arcEffect[a];
+      }
+      unsigned long long low = arcLow(a), span = arcSpan(a);
+      bool unbounded = (low + span == INFTY), effect = (arcEffect[a] != 0);
+      unsigned int kind = KIND_GENERAL;
+      if (arcSetter[a]){
+        if (!low && unbounded){kind = KIND_RESET;}
+      }else if (unbounded){
+        if (!low && !effect){continue;}
+        kind = low ? (effect ? KIND_CONSUME : KIND_READ) : KIND_PRODUCE;
+      }else if (!effect){
+        if (!low){kind = KIND_INHIBIT;}
+        if (!span){kind = KIND_EQUAL;}
+      }
+      sorted.push_back(std::pair<unsigned int, unsigned int>(kind, a));
+    }
+    if (produced > 0){conserving = false;}
+    std::stable_sort(sorted.begin(), sorted.end());
+    unsigned int checks = 0;
+    unsigned int i = 0;
+    for (unsigned int k = 0; k < KIND_COUNT; ++k){
+      kindStart.push_back(kindPlace.size());
+      for (; i < sorted.size() && sorted[i].first == k; ++i){
+        unsigned int a = sorted[i].second;
+        unsigned long long value = arcLow(a);
+        if (k == KIND_INHIBIT){value = arcSpan(a);}
+        if (k == KIND_GENERAL){value = a;}
+        kindPlace.push_back(arcPlace[a]);
+        kindValue.push_back(value);
+        kindEffect.push_back(arcEffect[a]);
+        kindTotal[k]++;
+        if (k != KIND_PRODUCE && k != KIND_RESET){kindChecks[chunk]++;}
+      }
+    }
+    if (kindStart[t * KIND_COUNT + KIND_PRODUCE] > kindStart[t * KIND_COUNT + KIND_READ]){checks |= CHECK_MIN;}
+    if (kindStart[t * KIND_COUNT + KIND_EQUAL] > kindStart[t * KIND_COUNT + KIND_INHIBIT]){checks |= CHECK_MAX;}
+    if (kindStart[t * KIND_COUNT + KIND_GENERAL] > kindStart[t * KIND_COUNT + KIND_EQUAL]){checks |= CHECK_EQUAL;}
+    if (kindPlace.size() > kindStart[t * KIND_COUNT + KIND_GENERAL]){checks |= CHECK_GENERAL;}
+    groups[chunk * CHECK_COMBINATIONS + checks].push_back(t);
+  }
+  kindStart.push_back(kindPlace.size());
+  for (unsigned int c = 0; c < groups.size(); ++c){
+    kindGroupStart.push_back(kindGroup.size());
+    kindGroup.insert(kindGroup.end(), groups[c].begin(), groups[c].end());
+  }
+  kindGroupStart.push_back(kindGroup.size());
+}
+
+/// \brief Builds the index from places to the arcs on them, used by the counters engine to find the arcs a marking change affects.
+void PetriCompiled::buildCounters(){
+  unsigned int places = placeIds.size();
+  arcTransition.assign(arcPlace.size(), 0);
+  for (unsigned int t = 0; t < transitionIds.size(); ++t){
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){arcTransition[a] = t;}
+  }
+  placeArcStart.assign(places + 1, 0);
+  for (unsigned int a = 0; a < arcPlace.size(); ++a){placeArcStart[arcPlace[a] + 1]++;}
+  for (unsigned int p = 0; p < places; ++p){placeArcStart[p + 1] += placeArcStart[p];}
+  placeArc.assign(arcPlace.size(), 0);
+  std::vector<unsigned int> fill(placeArcStart.begin(), placeArcStart.end() - 1);
+  for (unsigned int a = 0; a < arcPlace.size(); ++a){placeArc[fill[arcPlace[a]]++] = a;}
+  //High fan-out places also get their arcs sorted by both thresholds, see placeChanged
+  placeLowArc = placeArc;
+  placeHighArc = placeArc;
+  placeLowKey.assign(placeArc.size(), 0);
+  placeHighKey.assign(placeArc.size(), 0);
+  std::vector<std::pair<unsigned long long, unsigned int> > keys;
+  for (unsigned int p = 0; p < places; ++p){
+    unsigned int start = placeArcStart[p], end = placeArcStart[p + 1];
+    if (end - start < THRESHOLD_INDEX_MIN_ARCS){continue;}
+    for (unsigned int pass = 0; pass < 2; ++pass){
+      keys.clear();
+      for (unsigned int k = start; k < end; ++k){
+        unsigned int a = placeArc[k];
+        keys.push_back(std::make_pair(pass ? arcLow(a) + arcSpan(a) : arcLow(a), a));
+      }
+      std::sort(keys.begin(), keys.end());
+      for (unsigned int k = start; k < end; ++k){
+        if (pass){
+          placeHighKey[k] = keys[k - start].first;
+          placeHighArc[k] = keys[k - start].second;
+        }else{
+          placeLowKey[k] = keys[k - start].first;
+          placeLowArc[k] = keys[k - start].second;
+        }
+      }
+    }
+  }
+}
+
+/// \brief Starts counting how often each arc stops a scan, reordering the arcs by it every ADAPTIVE_REORDER_SCANS scans.
+///
+/// After warmupScans scans the order is fixed and counting stops. If saveFile is not empty, the counts are then written to it,
+/// for loadArcProfile in later runs. Only the scalar scan stops at the first failing arc, so only it benefits.
+void PetriCompiled::adaptArcs(unsigned long long warmupScans, std::string saveFile){
+  arcChecks.assign(arcPlace.size(), 0);
+  arcFails.assign(arcPlace.size(), 0);
+  adaptiveScans = warmupScans;
+  profileFile = saveFile;
+}
+
+/// Sorts arc indices by descending failure rate, as counted in arcChecks and arcFails.
+struct ArcFailOrder{
+  const PetriCompiled * net; ///< Net whose counts are compared.
+  bool operator()(unsigned int a, unsigned int b) const{
+    //Compares fails[a] / checks[a] > fails[b] / checks[b] without dividing, arcs never checked counting as never failing
+    return (double)net->arcFails[a] * net->arcChecks[b] > (double)net->arcFails[b] * net->arcChecks[a];
+  }
+};
+
+/// \brief Moves values[order[a]] to values[a], for every arc.
+template <class T> static void permuteArcs(std::vector<T> & values, const std::vector<unsigned int> & order){
+  std::vector<T> old(values);
+  for (unsigned int a = 0; a < order.size(); ++a){values[a] = old[order[a]];}
+}
+
+/// \brief Reorders the arcs of every transition by descending failure rate, so scans of disabled transitions stop early.
+///
+/// Ties keep their current order, so arcs without counts stay in place ID order. Fire and add do not depend on arc order.
+void PetriCompiled::reorderArcs(){
+  std::vector<unsigned int> order(arcPlace.size());
+  for (unsigned int a = 0; a < order.size(); ++a){order[a] = a;}
+  ArcFailOrder byRate = {this};
+  for (unsigned int t = 0; t < transitionIds.size(); ++t){
+    std::stable_sort(order.begin() + arcStart[t], order.begin() + arcStart[t + 1], byRate);
+  }
+  permuteArcs(arcPlace, order);
+  permuteArcs(arcLow32, order);
+  permuteArcs(arcSpan32, order);
+  permuteArcs(arcUsed, order);
+  permuteArcs(arcEffect, order);
+  permuteArcs(arcAdded, order);
+  permuteArcs(arcSetter, order);
+  if (arcChecks.size()){
+    permuteArcs(arcChecks, order);
+    permuteArcs(arcFails, order);
+  }
+  indexWideArcs();
+}
+
+/// \brief Renumbers the wide table in arc order, after the arcs were moved.
+void PetriCompiled::indexWideArcs(){
+  std::vector<unsigned long long> low(arcWideLow), span(arcWideSpan);
+  unsigned int w = 0;
+  for (unsigned int a = 0; a < arcSpan32.size(); ++a){
+    if (arcSpan32[a] != ARC_SPAN_WIDE){continue;}
+    arcWideArc[w] = a;
+    arcWideLow[w] = low[arcLow32[a]];
+    arcWideSpan[w] = span[arcLow32[a]];
+    arcLow32[a] = w++;
+  }
+}
+
+/// Magic line at the start of every arc profile, including the format version.
+#define ARC_PROFILE_MAGIC "PCARCS01"
+
+/// \brief Writes the arc failure counts as text: a magic line, then per arc its transition ID, place ID, checks and fails.
+/// Returns true on success, false on failure.
+bool PetriCompiled::saveArcProfile(std::string filename){
+  FILE * F = fopen(filename.c_str(), "w");
+  if (!F){
+    fprintf(stderr, "Error: Could not write arc profile %s\n", filename.c_str());
+    return false;
+  }
+  bool ok = (fprintf(F, "%s\n", ARC_PROFILE_MAGIC) > 0);
+  for (unsigned int t = 0; ok && t < transitionIds.size(); ++t){
+    for (unsigned int a = arcStart[t]; ok && a < arcStart[t + 1]; ++a){
+      ok = (fprintf(F, "%llu %llu %llu %llu\n", transitionIds[t], placeIds[arcPlace[a]], arcChecks[a], arcFails[a]) > 0);
+    }
+  }
+  ok = (fclose(F) == 0) && ok;
+  if (!ok){
+    fprintf(stderr, "Error: Could not write arc profile %s\n", filename.c_str());
+    return false;
+  }
+  fprintf(stderr, "Wrote arc profile %s\n", filename.c_str());
+  return true;
+}
+
+/// \brief Reads arc failure counts written by saveArcProfile and reorders the arcs by them, once.
+///
+/// The profile must have been written by a run of the same net. Arcs missing from the profile count as never failing.
+/// Returns true on success, false if the file could not be read or does not belong to this net.
+bool PetriCompiled::loadArcProfile(std::string filename){
+  FILE * F = fopen(filename.c_str(), "r");
+  if (!F){
+    fprintf(stderr, "Error: Could not read arc profile %s\n", filename.c_str());
+    return false;
+  }
+  char magic[16] = {0};
+  if (fscanf(F, "%15s", magic) != 1 || strcmp(magic, ARC_PROFILE_MAGIC)){
+    fprintf(stderr, "Error: %s is not a valid arc profile\n", filename.c_str());
+    fclose(F);
+    return false;
+  }
+  std::map<unsigned long long, unsigned int> transitionIndex;
+  for (unsigned int t = 0; t < transitionIds.size(); ++t){transitionIndex[transitionIds[t]] = t;}
+  std::vector<unsigned long long> checks(arcPlace.size(), 0), fails(arcPlace.size(), 0);
+  unsigned long long transitionId, placeId, c, f;
+  bool ok = true;
+  int fields;
+  while (ok && (fields = fscanf(F, "%llu %llu %llu %llu", &transitionId, &placeId, &c, &f)) == 4){
+    if (!transitionIndex.count(transitionId)){
+      ok = false;
+      break;
+    }
+    unsigned int t = transitionIndex[transitionId], p = placeIndex(placeId), a = arcStart[t];
+    while (a < arcStart[t + 1] && arcPlace[a] != p){++a;}
+    ok = (a < arcStart[t + 1]);
+    if (ok){
+      checks[a] = c;
+      fails[a] = f;
+    }
+  }
+  ok = ok && fields == EOF;
+  fclose(F);
+  if (!ok){
+    fprintf(stderr, "Error: Arc profile %s was made with a different net or is damaged\n", filename.c_str());
+    return false;
+  }
+  arcChecks = checks;
+  arcFails = fails;
+  reorderArcs();
+  return true;
+}
+
+/// \brief Splits the transitions into conflict components, so maximal steps can be grown per component.
+///
+/// Two transitions conflict when both use tokens of the same place, as only the summed used range limits a super-transition (see canAdd).
+/// Transitions in different components never compete for tokens, so the choices in one component cannot change those in another.
+/// Components are numbered in order of their lowest transition index.
+void PetriCompiled::buildComponents(){
+  unsigned int transitionCount = transitionIds.size();
+  std::vector<unsigned int> parent(transitionCount);
+  for (unsigned int t = 0; t < transitionCount; ++t){parent[t] = t;}
+  std::vector<unsigned int> user(placeIds.size(), transitionCount);
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+      if (!arcUsed[a]){continue;}
+      unsigned int p = arcPlace[a];
+      if (user[p] == transitionCount){
+        user[p] = t;
+        continue;
+      }
+      //Union by pointing the higher root at the lower one, with path halving
+      unsigned int x = t, y = user[p];
+      while (parent[x] != x){x = parent[x] = parent[parent[x]];}
+      while (parent[y] != y){y = parent[y] = parent[parent[y]];}
+      if (x < y){parent[y] = x;}
+      if (y < x){parent[x] = y;}
+    }
+  }
+  component.assign(transitionCount, 0);
+  componentCount = 0;
+  for (unsigned int t = 0; t < transitionCount; ++t){
+    unsigned int r = t;
+    while (parent[r] != r){r = parent[r];}
+    component[t] = (r == t) ? componentCount++ : component[r];
+  }
+}
+
+/// \brief Sizes all vectors of the given state for this net and sets it to the initial marking.
+void PetriCompiled::initState(PetriState & S){
+  unsigned int places = placeIds.size();
+  S.tokens = initialTokens;
+  S.enabled.assign(transitionIds.size() + 1, 0);
+  S.enabledCount = 0;
+  S.rangeBits.assign(chunkBitWord.back(), 0);
+  S.superUsed.assign(places, 0);
+  S.superEffect.assign(places, 0);
+  S.superAdded.assign(places, 0);
+  S.superSetter.assign(places, 0);
+  S.touched.assign(places, 0);
+  S.touchedList.clear();
+  S.touchedList.reserve(places);
+  S.chosen.clear();
+  unsigned int words = (places + 63) / 64 + 1;
+  S.bits.assign(words, 0);
+  S.superUsedBits.assign(words, 0);
+  S.superConsumeBits.assign(words, 0);
+  S.superAddBits.assign(words, 0);
+  S.superTwiceBits.assign(words, 0);
+  S.superSetterBits.assign(words, 0);
+  S.touchedWords.clear();
+  S.touchedWords.reserve(words);
+  S.kindEnabled.assign(transitionIds.size(), 0);
+  S.width = 64;
+  S.chunkCount.assign(chunkStart.size() - 1, 0);
+  S.chunkArcs.assign(chunkStart.size() - 1, 0);
+  S.compStart.assign(componentCount + 1, 0);
+  S.compList.assign(transitionIds.size(), 0);
+  S.activeComps.clear();
+  S.activeComps.reserve(componentCount);
+  S.compUsed.assign(places, 0);
+  S.stepSeed = 0;
+  S.budget.assign(places, 0);
+  S.arcOk.assign(arcPlace.size(), 0);
+  S.unsatisfied.assign(transitionIds.size(), 0);
+  S.enabledBits.assign((transitionIds.size() + 63) / 64, 0);
+  S.enabledTree.assign(transitionIds.size() + 1, 0);
+  S.counterEnabled = 0;
+  S.arcFlips = 0;
+  S.counterTokens.assign(places, 0);
+  loadTokens(S);
+}
+
+/// \brief Returns the amount of tokens in place index p, wherever the state keeps them.
+unsigned long long PetriCompiled::tokenCount(PetriState & S, unsigned int p){
+  if (S.bitsActive){return (S.bits[p >> 6] >> (p & 63)) & 1;}
+  switch (S.width){
+    case 8: return S.tokens8[p];
+    case 16: return S.tokens16[p];
+    case 32: return S.tokens32[p];
+  }
+  return S.tokens[p];
+}
+
+/// \brief Makes S.tokens reflect the current marking, if the state keeps it in bits or narrow token counts.
+void PetriCompiled::syncTokens(PetriState & S){
+  if (S.width != 64){
+    for (unsigned int p = 0; p < S.tokens.size(); ++p){S.tokens[p] = tokenCount(S, p);}
+  }
+  if (!S.bitsActive){return;}
+  for (unsigned int p = 0; p < S.tokens.size(); ++p){S.tokens[p] = (S.bits[p >> 6] >> (p & 63)) & 1;}
+}
+
+/// \brief Copies S.tokens into the narrowest marking of at least atLeast bits that holds it, for the kinds engine.
+///
+/// Only writes to S, so threads stepping their own states can share the compiled net.
+/// With atLeast 0, conserving nets get a width holding the total amount of tokens, so they never need to widen.
+/// Other nets get the narrowest width holding the current marking, and widen as soon as a firing would not fit.
+/// Split maximal steps read S.tokens directly, so they always use 64 bits.
+void PetriCompiled::narrowTokens(PetriState & S, unsigned int atLeast){
+  unsigned long long bound = 0, total = 0;
+  for (unsigned int p = 0; p < S.tokens.size(); ++p){
+    if (S.tokens[p] > bound){bound = S.tokens[p];}
+    total = (total + S.tokens[p] < total) ? ~0ull : total + S.tokens[p];
+  }
+  if (!atLeast && conserving){bound = total;}
+  S.width = atLeast ? atLeast : 8;
+  if (split != SPLIT_NONE){S.width = 64;}
+  while (S.width < 64 && bound > WIDTH_MAX(S.width)){S.width *= 2;}
+  unsigned int places = (S.width == 64) ? 0 : S.tokens.size();
+  S.tokens8.assign((S.width == 8) ? places : 0, 0);
+  S.tokens16.assign((S.width == 16) ? places : 0, 0);
+  S.tokens32.assign((S.width == 32) ? places : 0, 0);
+  for (unsigned int p = 0; p < places; ++p){
+    switch (S.width){
+      case 8: S.tokens8[p] = S.tokens[p]; break;
+      case 16: S.tokens16[p] = S.tokens[p]; break;
+      case 32: S.tokens32[p] = S.tokens[p]; break;
+    }
+  }
+}
+
+/// \brief Doubles the width of the marking of S, after a firing turned out not to fit, and notes the new width in S.widened.
+void PetriCompiled::widen(PetriState & S){
+  syncTokens(S);
+  unsigned int old = S.width;
+  S.width = 64;
+  narrowTokens(S, old * 2);
+  S.widened = S.width;
+}
+
+/// \brief Takes over the marking in S.tokens, keeping it in bits if the engine supports that and the marking is 1-safe.
+///
+/// The kinds engine keeps token counts in at least atLeast bits, or the compiled width if that is wider.
+void PetriCompiled::loadTokens(PetriState & S, unsigned int atLeast){
+  S.bitsActive = false;
+  S.width = 64;
+  if (engine == ENGINE_COUNTERS){resetCounters(S);}
+  if (engine == ENGINE_KINDS){narrowTokens(S, (atLeast > width) ? atLeast : width);}
+  if (engine != ENGINE_BITSET || !bitsSupported){return;}
+  for (unsigned int p = 0; p < S.tokens.size(); ++p){
+    if (S.tokens[p] > 1){return;}
+  }
+  for (unsigned int w = 0; w < S.bits.size(); ++w){S.bits[w] = 0;}
+  for (unsigned int p = 0; p < S.tokens.size(); ++p){S.bits[p >> 6] |= S.tokens[p] << (p & 63);}
+  S.bitsActive = true;
+}
+
+/// \brief Returns the place index for the given place ID, or the amount of places if unknown.
+unsigned int PetriCompiled::placeIndex(unsigned long long placeId){
+  std::map<unsigned long long, unsigned int>::iterator it = placeIndices.find(placeId);
+  if (it == placeIndices.end()){return placeIds.size();}
+  return it->second;
+}
+
+/// \brief Returns true if bits start up to but not including end are all set.
+static inline bool allBitsSet(const unsigned long long * bits, unsigned int start, unsigned int end){
+  while (start < end){
+    unsigned int offset = start & 63;
+    unsigned int len = end - start;
+    if (len > 64 - offset){len = 64 - offset;}
+    unsigned long long mask = (len == 64) ? ~0ull : (((1ull << len) - 1) << offset);
+    if ((bits[start >> 6] & mask) != mask){return false;}
+    start += len;
+  }
+  return true;
+}
+
+/// \brief Checks the enabledness of count transitions from list, which all need exactly the given checks, into enabled.
+///
+/// Instantiated once per check bitmask, so every loop for a check the transitions do not need is removed at compile time,
+/// and the remaining loops each do a single comparison per arc without branching on the arc kind.
+/// Also instantiated per token type, for markings kept in fewer than 64 bits.
+template <class T, unsigned int checks>
+static void checkKinds(const PetriCompiled & C, const T * tokens, const unsigned int * list, unsigned int count, unsigned char * enabled){
+  const unsigned int * place = &C.kindPlace[0];
+  const unsigned long long * value = &C.kindValue[0];
+  for (unsigned int i = 0; i < count; ++i){
+    unsigned int t = list[i];
+    const unsigned int * start = &C.kindStart[t * KIND_COUNT];
+    bool ok = true;
+    if (checks & CHECK_MIN){
+      for (unsigned int k = start[KIND_READ]; k < start[KIND_PRODUCE]; ++k){ok &= (tokens[place[k]] >= value[k]);}
+    }
+    if (checks & CHECK_MAX){
+      for (unsigned int k = start[KIND_INHIBIT]; k < start[KIND_EQUAL]; ++k){ok &= (tokens[place[k]] <= value[k]);}
+    }
+    if (checks & CHECK_EQUAL){
+      for (unsigned int k = start[KIND_EQUAL]; k < start[KIND_GENERAL]; ++k){ok &= (tokens[place[k]] == value[k]);}
+    }
+    if (checks & CHECK_GENERAL){
+      for (unsigned int k = start[KIND_GENERAL]; k < start[KIND_COUNT]; ++k){
+        unsigned int a = value[k];
+        ok &= C.arcHolds(a, tokens[place[k]]);
+      }
+    }
+    enabled[t] = ok;
+  }
+}
+
+/// Kernel per check bitmask, for token type T.
+template <class T> struct KindKernels{
+  static void (* const table[CHECK_COMBINATIONS])(const PetriCompiled &, const T *, const unsigned int *, unsigned int, unsigned char *);
+};
+template <class T> void (* const KindKernels<T>::table[CHECK_COMBINATIONS])(const PetriCompiled &, const T *, const unsigned int *, unsigned int, unsigned char *) = {
+  checkKinds<T, 0>, checkKinds<T, 1>, checkKinds<T, 2>, checkKinds<T, 3>, checkKinds<T, 4>, checkKinds<T, 5>, checkKinds<T, 6>, checkKinds<T, 7>,
+  checkKinds<T, 8>, checkKinds<T, 9>, checkKinds<T, 10>, checkKinds<T, 11>, checkKinds<T, 12>, checkKinds<T, 13>, checkKinds<T, 14>, checkKinds<T, 15>
+};
+
+/// \brief Runs the kernel of every group of transitions in scan chunk c over the marking tokens.
+template <class T>
+static void scanKinds(const PetriCompiled & C, const T * tokens, unsigned int c, unsigned char * flags){
+  for (unsigned int g = c * CHECK_COMBINATIONS; g < (c + 1) * CHECK_COMBINATIONS; ++g){
+    unsigned int start = C.kindGroupStart[g], end = C.kindGroupStart[g + 1];
+    if (start < end){KindKernels<T>::table[g % CHECK_COMBINATIONS](C, tokens, &C.kindGroup[start], end - start, flags);}
+  }
+}
+
+/// \brief Checks the transitions of scan chunk c, writing the enabled ones to S.enabled starting at the first transition index of the chunk.
+///
+/// Transitions are written unconditionally and the count only advanced when enabled, as a branch on a random enabled pattern would mispredict often.
+/// The scalar version checks one transition at a time and stops at the first arc that disables it.
+/// The SIMD versions first evaluate the range function of every arc in the chunk without any branches, then check per transition whether all of its bits are set.
+/// The kinds engine runs the kernel of each group of transitions in the chunk over that whole group.
+/// Only touches data of this chunk, so different chunks can be scanned at the same time.
+void PetriCompiled::scanChunk(PetriState & S, unsigned int c){
+  unsigned int first = chunkStart[c], last = chunkStart[c + 1];
+  const unsigned long long * tokens = &S.tokens[0];
+  unsigned int * enabled = &S.enabled[first], count = 0;
+  if (S.bitsActive){
+    //Without early exits or branches on the result, as transitions touch few words and the enabled pattern is random
+    const unsigned long long * bits = &S.bits[0];
+    for (unsigned int t = first; t < last; ++t){
+      bool ok = !bitDead[t];
+      for (unsigned int e = bitStart[t]; e < bitStart[t + 1]; ++e){
+        unsigned long long w = bits[bitWord[e]];
+        ok &= ((w & bitPre[e]) == bitPre[e]) & !(w & bitInhib[e]);
+      }
+      enabled[count] = t;
+      count += ok;
+    }
+    S.chunkArcs[c] = bitStart[last] - bitStart[first];
+  }else if (engine == ENGINE_KINDS){
+    unsigned char * flags = &S.kindEnabled[0];
+    switch (S.width){
+      case 8: scanKinds(*this, &S.tokens8[0], c, flags); break;
+      case 16: scanKinds(*this, &S.tokens16[0], c, flags); break;
+      case 32: scanKinds(*this, &S.tokens32[0], c, flags); break;
+      default: scanKinds(*this, tokens, c, flags); break;
+    }
+    for (unsigned int t = first; t < last; ++t){
+      enabled[count] = t;
+      count += flags[t];
+    }
+    S.chunkArcs[c] = kindChecks[c];
+  }else if (isa == ISA_SCALAR || TRACE_ON(TRACE_RANGE, 1)){
+    unsigned long long arcs = 0;
+    bool counting = adaptiveScans;
+    for (unsigned int t = first; t < last; ++t){
+      unsigned int a = arcStart[t], end = arcStart[t + 1];
+      for (; a < end; ++a){
+        if (!arcHolds(a, tokens[arcPlace[a]])){break;}
+      }
+      if (counting){
+        for (unsigned int k = arcStart[t]; k < end && k <= a; ++k){arcChecks[k]++;}
+        if (a < end){arcFails[a]++;}
+      }
+      arcs += a - arcStart[t] + (a < end);
+      enabled[count] = t;
+      count += (a == end);
+    }
+    S.chunkArcs[c] = arcs;
+  }else{
+    unsigned int base = arcStart[first], arcCount = arcStart[last] - base;
+    unsigned long long * bits = &S.rangeBits[chunkBitWord[c]];
+    if (isa == ISA_AVX512){
+      rangeBitsAvx512(&arcPlace[base], &arcLow32[base], &arcSpan32[base], tokens, bits, arcCount);
+    }else{
+      rangeBitsAvx2(&arcPlace[base], &arcLow32[base], &arcSpan32[base], tokens, bits, arcCount);
+    }
+    //The kernels only know 32-bit arcs, so correct the results of the wide ones
+    std::vector<unsigned int>::iterator w = std::lower_bound(arcWideArc.begin(), arcWideArc.end(), base);
+    for (; w != arcWideArc.end() && *w < base + arcCount; w++){
+      unsigned int i = *w - base;
+      if (arcHolds(*w, tokens[arcPlace[*w]])){
+        bits[i >> 6] |= 1ull << (i & 63);
+      }else{
+        bits[i >> 6] &= ~(1ull << (i & 63));
+      }
+    }
+    for (unsigned int t = first; t < last; ++t){
+      enabled[count] = t;
+      count += allBitsSet(bits, arcStart[t] - base, arcStart[t + 1] - base);
+    }
+    S.chunkArcs[c] = arcCount;
+  }
+  S.chunkCount[c] = count;
+}
+
+/// Arguments of scanJob.
+struct ScanJob{
+  PetriCompiled * net; ///< Net being scanned.
+  PetriState * state; ///< State being scanned.
+};
+
+/// \brief Thread pool job scanning a single chunk.
+void PetriCompiled::scanJob(void * arg, unsigned int c){
+  ScanJob * job = (ScanJob *)arg;
+  job->net->scanChunk(*job->state, c);
+}
+
+/// \brief Fills S.enabled with all enabled transitions, in ascending order.
+///
+/// Large nets compiled for more than one thread are scanned in chunks on the thread pool of the state.
+/// Every chunk writes its enabled transitions to its own part of S.enabled, after which they are moved together in chunk order,
+/// so the result is exactly that of a single-threaded scan.
+void PetriCompiled::scan(PetriState & S, PetriStats & stats){
+  if (engine == ENGINE_COUNTERS){
+    //The counters already know, only list them
+    unsigned int count = 0;
+    for (unsigned int w = 0; w < S.enabledBits.size(); ++w){
+      for (unsigned long long bits = S.enabledBits[w]; bits; bits &= bits - 1){S.enabled[count++] = w * 64 + __builtin_ctzll(bits);}
+    }
+    S.enabledCount = count;
+    stats.arcsEvaluated += S.arcFlips;
+    S.arcFlips = 0;
+    return;
+  }
+  unsigned int chunks = chunkStart.size() - 1;
+  if (S.pool && chunks > 1){
+    ScanJob job = {this, &S};
+    S.pool->run(chunks, scanJob, &job);
+  }else{
+    for (unsigned int c = 0; c < chunks; ++c){scanChunk(S, c);}
+  }
+  unsigned int count = 0;
+  for (unsigned int c = 0; c < chunks; ++c){
+    if (count != chunkStart[c]){
+      std::copy(S.enabled.begin() + chunkStart[c], S.enabled.begin() + chunkStart[c] + S.chunkCount[c], S.enabled.begin() + count);
+    }
+    count += S.chunkCount[c];
+    stats.arcsEvaluated += S.chunkArcs[c];
+  }
+  S.enabledCount = count;
+  stats.enabledChecks += transitionIds.size();
+  if (adaptiveScans){
+    adaptiveScans--;
+    if (adaptiveScans % ADAPTIVE_REORDER_SCANS == 0){
+      reorderArcs();
+      if (!adaptiveScans && profileFile.size()){saveArcProfile(profileFile);}
+    }
+  }
+}
+
+/// \brief Removes position i from S.enabled, keeping the order.
+static inline void removeEnabled(PetriState & S, unsigned int i){
+  std::copy(S.enabled.begin() + i + 1, S.enabled.begin() + S.enabledCount, S.enabled.begin() + i);
+  S.enabledCount--;
+}
+
+/// \brief Picks a random position in S.enabled, taking weights into account.
+///
+/// Consumes random numbers exactly like PetriNet::pickTransition does, so all engines make the same choices.
+unsigned int PetriCompiled::pick(PetriState & S){
+  return pickFrom(S.rng, &S.enabled[0], S.enabledCount);
+}
+
+/// \brief Picks a random position in the given list of count transitions, taking weights into account, using the given generator.
+unsigned int PetriCompiled::pickFrom(PetriRandom & rng, const unsigned int * list, unsigned int count){
+  if (!weighted){return rng.below(count);}
+  unsigned long long total = 0;
+  for (unsigned int i = 0; i < count; ++i){total += weights[list[i]];}
+  unsigned long long r = rng.below(total);
+  unsigned int i = 0;
+  for (; i < count; ++i){
+    if (r < weights[list[i]]){break;}
+    r -= weights[list[i]];
+  }
+  return i;
+}
+
+/// \brief Returns true if the super-transition in S stays enabled when transition t is added to it.
+///
+/// Both t and the super-transition are enabled in the current marking, so the combined low and high bounds are always met.
+/// Only the combined used range, the sum of both, can exceed the marking.
+bool PetriCompiled::canAdd(PetriState & S, unsigned int t){
+  for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+    unsigned int p = arcPlace[a];
+    unsigned long long m = (S.width == 64) ? S.tokens[p] : tokenCount(S, p);
+    if (S.superUsed[p] + arcUsed[a] > m){return false;}
+  }
+  return true;
+}
+
+/// \brief Combines transition t into the super-transition in S, following the combination operator.
+void PetriCompiled::add(PetriState & S, unsigned int t){
+  for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+    unsigned int p = arcPlace[a];
+    if (!S.touched[p]){
+      S.touched[p] = 1;
+      S.touchedList.push_back(p);
+    }
+    S.superUsed[p] += arcUsed[a];
+    S.superEffect[p] += arcEffect[a];
+    S.superAdded[p] += arcAdded[a];
+    S.superSetter[p] |= arcSetter[a];
+  }
+}
+
+/// \brief Applies the effect of transition t to S.tokens.
+void PetriCompiled::fire(PetriState & S, unsigned int t){
+  for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+    if (arcSetter[a]){
+      S.tokens[arcPlace[a]] = arcEffect[a];
+    }else{
+      S.tokens[arcPlace[a]] += arcEffect[a];
+    }
+  }
+  if (engine == ENGINE_COUNTERS){
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){placeChanged(S, arcPlace[a]);}
+  }
+}
+
+/// \brief Returns true if adding effect to a count of m tokens stays within 0 and max.
+static inline bool effectFits(unsigned long long m, long long effect, unsigned long long max){
+  return (effect >= 0) ? max - m >= (unsigned long long)effect : m >= 0ull - (unsigned long long)effect;
+}
+
+/// \brief Applies the effect of transition t to the marking tokens, like fire() but using the arcs sorted by kind.
+///
+/// Returns false without changing anything if a count would not fit in T or drop below zero.
+template <class T>
+static bool fireKindsAt(const PetriCompiled & C, T * tokens, unsigned int t){
+  const unsigned long long max = (T)~(T)0;
+  const unsigned int * start = &C.kindStart[t * KIND_COUNT];
+  const unsigned int * place = &C.kindPlace[0];
+  bool fits = true;
+  for (unsigned int k = start[KIND_CONSUME]; k < start[KIND_RESET]; ++k){fits &= effectFits(tokens[place[k]], C.kindEffect[k], max);}
+  for (unsigned int k = start[KIND_RESET]; k < start[KIND_INHIBIT]; ++k){fits &= ((unsigned long long)C.kindEffect[k] <= max);}
+  for (unsigned int k = start[KIND_GENERAL]; k < start[KIND_COUNT]; ++k){
+    unsigned int a = C.kindValue[k];
+    if (C.arcSetter[a]){
+      fits &= ((unsigned long long)C.arcEffect[a] <= max);
+    }else{
+      fits &= effectFits(tokens[place[k]], C.arcEffect[a], max);
+    }
+  }
+  if (!fits){return false;}
+  for (unsigned int k = start[KIND_CONSUME]; k < start[KIND_RESET]; ++k){tokens[place[k]] += C.kindEffect[k];}
+  for (unsigned int k = start[KIND_RESET]; k < start[KIND_INHIBIT]; ++k){tokens[place[k]] = C.kindEffect[k];}
+  for (unsigned int k = start[KIND_GENERAL]; k < start[KIND_COUNT]; ++k){
+    unsigned int a = C.kindValue[k];
+    if (C.arcSetter[a]){
+      tokens[place[k]] = C.arcEffect[a];
+    }else{
+      tokens[place[k]] += C.arcEffect[a];
+    }
+  }
+  return true;
+}
+
+/// \brief Applies the effect of transition t to the marking of S, widening the marking first if it would not fit.
+///
+/// Returns false without firing if a token count would leave the 64-bit range.
+bool PetriCompiled::fireKinds(PetriState & S, unsigned int t){
+  while (true){
+    bool fits;
+    switch (S.width){
+      case 8: fits = fireKindsAt(*this, &S.tokens8[0], t); break;
+      case 16: fits = fireKindsAt(*this, &S.tokens16[0], t); break;
+      case 32: fits = fireKindsAt(*this, &S.tokens32[0], t); break;
+      default: fits = fireKindsAt(*this, &S.tokens[0], t); break;
+    }
+    if (fits){return true;}
+    if (S.width == 64){
+      fprintf(stderr, "Error: Firing transition %s would take a token count out of range. Cancelling run.\n", transitionNames[t]);
+      return false;
+    }
+    widen(S);
+  }
+}
+
+/// \brief Widens the marking of S until every place touched by the super-transition fits its new count.
+///
+/// Returns false if a new count would leave the 64-bit range.
+bool PetriCompiled::fitSuper(PetriState & S){
+  for (unsigned int i = 0; i < S.touchedList.size(); ++i){
+    unsigned int p = S.touchedList[i];
+    unsigned long long m = tokenCount(S, p);
+    while (true){
+      unsigned long long max = WIDTH_MAX(S.width);
+      bool fits;
+      if (S.superSetter[p]){
+        fits = ((unsigned long long)S.superAdded[p] <= max);
+      }else{
+        fits = effectFits(m, S.superEffect[p], max);
+      }
+      if (fits){break;}
+      if (S.width == 64){
+        fprintf(stderr, "Error: Firing the chosen transitions would take the token count of place %u out of range. Cancelling run.\n", p);
+        return false;
+      }
+      widen(S);
+    }
+  }
+  return true;
+}
+
+/// \brief Applies the combined effect of the super-transition in S to its marking, and clears the super-transition for the next step.
+///
+/// Returns false without firing if a token count would leave the 64-bit range.
+bool PetriCompiled::fireSuper(PetriState & S){
+  if (engine == ENGINE_KINDS && !fitSuper(S)){return false;}
+  for (unsigned int i = 0; i < S.touchedList.size(); ++i){
+    unsigned int p = S.touchedList[i];
+    unsigned long long m;
+    if (S.superSetter[p]){
+      m = S.superAdded[p];
+    }else{
+      m = tokenCount(S, p) + S.superEffect[p];
+    }
+    switch (S.width){
+      case 8: S.tokens8[p] = m; break;
+      case 16: S.tokens16[p] = m; break;
+      case 32: S.tokens32[p] = m; break;
+      default: S.tokens[p] = m; break;
+    }
+    S.superUsed[p] = 0;
+    S.superEffect[p] = 0;
+    S.superAdded[p] = 0;
+    S.superSetter[p] = 0;
+    S.touched[p] = 0;
+  }
+  if (engine == ENGINE_COUNTERS){
+    for (unsigned int i = 0; i < S.touchedList.size(); ++i){placeChanged(S, S.touchedList[i]);}
+  }
+  S.touchedList.clear();
+  return true;
+}
+
+/// \brief Moves the marking of S from bits to tokens, after which stepping continues as on the simd engine.
+void PetriCompiled::leaveBits(PetriState & S, PetriStats & stats){
+  syncTokens(S);
+  S.bitsActive = false;
+  fprintf(stderr, "Marking is no longer 1-safe after step %llu, continuing with the simd engine\n", stats.steps);
+}
+
+/// \brief Does a single calculation step on the given state, with the same results as PetriNet::calculateStep on the map engine.
+///
+/// Returns true if a step was completed, false if no more transitions are enabled or a token count left the 64-bit range.
+bool PetriCompiled::step(int stepMode, PetriState & S, PetriStats & stats){
+  if (stepMode != SINGLE_STEP && stepMode != MAX_AUTOCON_STEP){
+    std::cerr << "Step type not implemented. Cancelling run." << std::endl;
+    return false;
+  }
+  if (S.bitsActive){return stepBits(stepMode, S, stats);}
+  if (stepMode == SINGLE_STEP && engine == ENGINE_COUNTERS){return stepCounters(S, stats);}
+  if (stepMode == MAX_AUTOCON_STEP && split == SPLIT_COMPONENTS){return stepComponents(S, stats);}
+  if (stepMode == MAX_AUTOCON_STEP && split == SPLIT_RESERVE){return stepReserve(S, stats);}
+  unsigned long long phaseStart = stats.begin();
+  scan(S, stats);
+  phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+  stats.enabledHistogram[PetriStats::bucket(S.enabledCount)]++;
+  if (TRACE_ON(TRACE_STEP, 2)){
+    unsigned long long args[1] = {S.enabledCount};
+    traceRecord((stepMode == SINGLE_STEP) ? EV_SINGLE_ENABLED : EV_MAX_ENABLED, 1, args);
+  }
+  if (!S.enabledCount){return false;}
+
+  if (stepMode == SINGLE_STEP){
+    unsigned int t = S.enabled[pick(S)];
+    if (TRACE_ON(TRACE_STEP, 1)){
+      traceRecord(EV_SINGLE_PICKED, 0, 0, transitionNames[t]);
+    }
+    phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+    if (engine == ENGINE_KINDS){
+      if (!fireKinds(S, t)){return false;}
+    }else{
+      fire(S, t);
+    }
+    stats.phase(PHASE_FIRE, phaseStart);
+    stats.superHistogram[1]++;
+    stats.steps++;
+    return true;
+  }
+
+  //Maximal auto-concurrent step: keep adding random enabled transitions to the super-transition until none fit
+  std::map<unsigned int, unsigned long long> chosen;
+  bool tracing = TRACE_ON(TRACE_STEP, 1);
+  unsigned int t = S.enabled[pick(S)];
+  add(S, t);
+  if (tracing){chosen[t]++;}
+  unsigned long long superSize = 1;
+  while (S.enabledCount){
+    unsigned int i = pick(S);
+    t = S.enabled[i];
+    stats.enabledChecks++;
+    stats.arcsEvaluated += arcStart[t + 1] - arcStart[t];
+    if (canAdd(S, t)){
+      add(S, t);
+      superSize++;
+      if (tracing){chosen[t]++;}
+    }else{
+      removeEnabled(S, i);
+    }
+  }
+  phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+  stats.superHistogram[PetriStats::bucket(superSize)]++;
+  if (tracing){
+    std::map<unsigned int, unsigned long long>::iterator C;
+    for (C = chosen.begin(); C != chosen.end(); C++){
+      unsigned long long args[1] = {C->second};
+      traceRecord(EV_MAX_PICKED, 1, args, transitionNames[C->first]);
+    }
+  }
+  if (!fireSuper(S)){return false;}
+  stats.phase(PHASE_FIRE, phaseStart);
+  stats.steps++;
+  return true;
+}
+
+/// Arguments of componentJob.
+struct ComponentJob{
+  PetriCompiled * net; ///< Net being stepped.
+  PetriState * state; ///< State being stepped.
+};
+
+/// \brief Thread pool job growing the components of a single job.
+void PetriCompiled::componentJob(void * arg, unsigned int job){
+  ComponentJob * J = (ComponentJob *)arg;
+  J->net->growComponents(*J->state, job);
+}
+
+/// \brief Chooses the transitions of every active component of the given job, like step() does for the whole net.
+///
+/// Every component uses its own generator, seeded from the step seed and its component number,
+/// so the result does not depend on how components are spread over jobs and threads.
+/// Components share no used places, so S.compUsed can be shared by all jobs.
+void PetriCompiled::growComponents(PetriState & S, unsigned int job){
+  std::vector<unsigned int> & chosen = S.jobChosen[job];
+  unsigned long long checks = 0, arcs = 0;
+  chosen.clear();
+  PetriRandom rng;
+  for (unsigned int j = S.jobFirst[job]; j < S.jobFirst[job + 1]; ++j){
+    unsigned int c = S.activeComps[j];
+    unsigned int * list = &S.compList[S.compStart[c]], count = S.compStart[c + 1] - S.compStart[c];
+    unsigned int firstChosen = chosen.size();
+    rng.seed(S.stepSeed + c * 0xD1B54A32D192ED03ull);
+    bool first = true;
+    while (count){
+      unsigned int i = pickFrom(rng, list, count), t = list[i];
+      bool fits = true;
+      if (!first){
+        checks++;
+        arcs += arcStart[t + 1] - arcStart[t];
+        for (unsigned int a = arcStart[t]; a < arcStart[t + 1] && fits; ++a){
+          fits = (S.compUsed[arcPlace[a]] + arcUsed[a] <= S.tokens[arcPlace[a]]);
+        }
+      }
+      first = false;
+      if (fits){
+        for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){S.compUsed[arcPlace[a]] += arcUsed[a];}
+        chosen.push_back(t);
+      }else{
+        std::copy(list + i + 1, list + count, list + i);
+        count--;
+      }
+    }
+    for (unsigned int k = firstChosen; k < chosen.size(); ++k){
+      unsigned int t = chosen[k];
+      for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){S.compUsed[arcPlace[a]] = 0;}
+    }
+  }
+  S.jobChecks[job] = checks;
+  S.jobArcs[job] = arcs;
+}
+
+/// \brief Does a maximal auto-concurrent step by growing the super-transition of every conflict component independently.
+///
+/// Within a component, transitions are picked exactly as step() picks them from the whole net, so every component
+/// gets its own maximal multiset with the same distribution. Components are spread over the thread pool when there is enough work.
+/// The random numbers drawn differ from step(), so the trajectory differs from the other engines, but does not depend on the amount of threads.
+bool PetriCompiled::stepComponents(PetriState & S, PetriStats & stats){
+  unsigned long long phaseStart = stats.begin();
+  scan(S, stats);
+  phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+  stats.enabledHistogram[PetriStats::bucket(S.enabledCount)]++;
+  if (TRACE_ON(TRACE_STEP, 2)){
+    unsigned long long args[1] = {S.enabledCount};
+    traceRecord(EV_MAX_ENABLED, 1, args);
+  }
+  if (!S.enabledCount){return false;}
+
+  //Sort the enabled transitions by component, keeping them ascending within each component
+  for (unsigned int i = 0; i < S.enabledCount; ++i){S.compStart[component[S.enabled[i]] + 1]++;}
+  S.activeComps.clear();
+  for (unsigned int c = 0; c < componentCount; ++c){
+    if (S.compStart[c + 1]){S.activeComps.push_back(c);}
+    S.compStart[c + 1] += S.compStart[c];
+  }
+  for (unsigned int i = 0; i < S.enabledCount; ++i){
+    unsigned int t = S.enabled[i];
+    S.compList[S.compStart[component[t]]++] = t;
+  }
+  //Filling moved every start to the start of the next component, move them back
+  for (unsigned int c = componentCount; c > 0; --c){S.compStart[c] = S.compStart[c - 1];}
+  S.compStart[0] = 0;
+
+  S.stepSeed = S.rng.next();
+  unsigned int active = S.activeComps.size(), jobs = 1;
+  if (S.pool && S.enabledCount >= PARALLEL_MIN_ENABLED){
+    jobs = S.pool->size() * COMPONENT_JOBS_PER_THREAD;
+    if (jobs > active){jobs = active;}
+  }
+  if (S.jobChosen.size() < jobs){
+    S.jobChosen.resize(jobs);
+    S.jobChecks.resize(jobs);
+    S.jobArcs.resize(jobs);
+  }
+  S.jobFirst.resize(jobs + 1);
+  for (unsigned int j = 0; j <= jobs; ++j){S.jobFirst[j] = (unsigned long long)active * j / jobs;}
+  if (jobs > 1){
+    ComponentJob job = {this, &S};
+    S.pool->run(jobs, componentJob, &job);
+  }else{
+    growComponents(S, 0);
+  }
+
+  //Merge all components into a single super-transition, in component order
+  std::map<unsigned int, unsigned long long> chosen;
+  bool tracing = TRACE_ON(TRACE_STEP, 1);
+  unsigned long long superSize = 0;
+  for (unsigned int j = 0; j < jobs; ++j){
+    std::vector<unsigned int> & list = S.jobChosen[j];
+    for (unsigned int k = 0; k < list.size(); ++k){
+      add(S, list[k]);
+      if (tracing){chosen[list[k]]++;}
+    }
+    superSize += list.size();
+    stats.enabledChecks += S.jobChecks[j];
+    stats.arcsEvaluated += S.jobArcs[j];
+  }
+  for (unsigned int c = 0; c <= componentCount; ++c){S.compStart[c] = 0;}
+  phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+  stats.superHistogram[PetriStats::bucket(superSize)]++;
+  if (tracing){
+    std::map<unsigned int, unsigned long long>::iterator C;
+    for (C = chosen.begin(); C != chosen.end(); C++){
+      unsigned long long args[1] = {C->second};
+      traceRecord(EV_MAX_PICKED, 1, args, transitionNames[C->first]);
+    }
+  }
+  if (!fireSuper(S)){return false;}
+  stats.phase(PHASE_FIRE, phaseStart);
+  stats.steps++;
+  return true;
+}
+
+/// \brief Thread pool job reserving tokens for a single slice of the enabled transitions.
+void PetriCompiled::reserveJob(void * arg, unsigned int job){
+  ComponentJob * J = (ComponentJob *)arg;
+  J->net->reserveSlice(*J->state, job);
+}
+
+/// \brief Grows the part of the super-transition for the given slice of S.enabled, reserving tokens from S.budget.
+///
+/// Picks random transitions from the slice and reserves the used range of all of their arcs with compare-and-swap, one place at a time.
+/// When a place has too few tokens left, the places reserved so far for that transition are given back and the transition leaves the slice.
+/// Slices of different jobs may share places, so all access to S.budget is atomic.
+void PetriCompiled::reserveSlice(PetriState & S, unsigned int job){
+  std::vector<unsigned int> & chosen = S.jobChosen[job];
+  unsigned long long checks = 0, arcs = 0;
+  unsigned long long * budget = &S.budget[0];
+  unsigned int * list = &S.enabled[S.jobFirst[job]], count = S.jobFirst[job + 1] - S.jobFirst[job];
+  PetriRandom rng;
+  rng.seed(S.stepSeed + job * 0xD1B54A32D192ED03ull);
+  chosen.clear();
+  while (count){
+    unsigned int i = pickFrom(rng, list, count), t = list[i];
+    unsigned int a = arcStart[t];
+    checks++;
+    for (; a < arcStart[t + 1]; ++a){
+      unsigned long long used = arcUsed[a];
+      if (!used){continue;}
+      unsigned long long * b = budget + arcPlace[a];
+      unsigned long long left = __atomic_load_n(b, __ATOMIC_RELAXED);
+      while (left >= used && !__atomic_compare_exchange_n(b, &left, left - used, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){}
+      if (left < used){break;}
+    }
+    arcs += a - arcStart[t] + (a < arcStart[t + 1]);
+    if (a == arcStart[t + 1]){
+      chosen.push_back(t);
+      continue;
+    }
+    //Roll back the partial reservation, the order of the slice does not matter anymore
+    for (unsigned int r = arcStart[t]; r < a; ++r){
+      if (arcUsed[r]){__atomic_fetch_add(budget + arcPlace[r], arcUsed[r], __ATOMIC_ACQ_REL);}
+    }
+    list[i] = list[--count];
+  }
+  S.jobChecks[job] = checks;
+  S.jobArcs[job] = arcs;
+}
+
+/// \brief Does a maximal auto-concurrent step by letting every thread grow the super-transition for its own slice of the enabled transitions.
+///
+/// All threads reserve tokens from a shared per-place budget, starting at the marking, so together they never use more tokens than there are.
+/// A transition leaves its slice once it does not fit anymore. Budgets only shrink, except for a short while during the rollback of a
+/// failed reservation, which may let another thread wrongly conclude a transition does not fit. So when more than one thread worked on
+/// the step, a serial pass afterwards adds every enabled transition that still fits, as often as it fits, which makes the step maximal.
+/// The step is a valid maximal auto-concurrent step, but with more than one job the choices depend on thread timing, so runs are not reproducible.
+bool PetriCompiled::stepReserve(PetriState & S, PetriStats & stats){
+  unsigned long long phaseStart = stats.begin();
+  scan(S, stats);
+  phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+  stats.enabledHistogram[PetriStats::bucket(S.enabledCount)]++;
+  if (TRACE_ON(TRACE_STEP, 2)){
+    unsigned long long args[1] = {S.enabledCount};
+    traceRecord(EV_MAX_ENABLED, 1, args);
+  }
+  if (!S.enabledCount){return false;}
+
+  std::copy(S.tokens.begin(), S.tokens.end(), S.budget.begin());
+  S.stepSeed = S.rng.next();
+  unsigned int jobs = 1;
+  if (S.pool && S.enabledCount >= PARALLEL_MIN_ENABLED){jobs = S.pool->size();}
+  if (S.jobChosen.size() < jobs){
+    S.jobChosen.resize(jobs);
+    S.jobChecks.resize(jobs);
+    S.jobArcs.resize(jobs);
+  }
+  S.jobFirst.resize(jobs + 1);
+  for (unsigned int j = 0; j <= jobs; ++j){S.jobFirst[j] = (unsigned long long)S.enabledCount * j / jobs;}
+  if (jobs > 1){
+    ComponentJob job = {this, &S};
+    S.pool->run(jobs, reserveJob, &job);
+  }else{
+    reserveSlice(S, 0);
+  }
+  if (jobs > 1){
+    //Completion pass: budgets only shrink from here on, so whatever does not fit now never will
+    std::vector<unsigned int> & chosen = S.jobChosen[0];
+    for (unsigned int i = 0; i < S.enabledCount; ++i){
+      unsigned int t = S.enabled[i];
+      while (true){
+        stats.enabledChecks++;
+        stats.arcsEvaluated += arcStart[t + 1] - arcStart[t];
+        unsigned int a = arcStart[t];
+        for (; a < arcStart[t + 1]; ++a){
+          if (S.budget[arcPlace[a]] < arcUsed[a]){break;}
+        }
+        if (a < arcStart[t + 1]){break;}
+        for (a = arcStart[t]; a < arcStart[t + 1]; ++a){S.budget[arcPlace[a]] -= arcUsed[a];}
+        chosen.push_back(t);
+      }
+    }
+  }
+
+  //Merge all slices into a single super-transition
+  std::map<unsigned int, unsigned long long> chosen;
+  bool tracing = TRACE_ON(TRACE_STEP, 1);
+  unsigned long long superSize = 0;
+  for (unsigned int j = 0; j < jobs; ++j){
+    std::vector<unsigned int> & list = S.jobChosen[j];
+    for (unsigned int k = 0; k < list.size(); ++k){
+      add(S, list[k]);
+      if (tracing){chosen[list[k]]++;}
+    }
+    superSize += list.size();
+    stats.enabledChecks += S.jobChecks[j];
+    stats.arcsEvaluated += S.jobArcs[j];
+  }
+  phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+  stats.superHistogram[PetriStats::bucket(superSize)]++;
+  if (tracing){
+    std::map<unsigned int, unsigned long long>::iterator C;
+    for (C = chosen.begin(); C != chosen.end(); C++){
+      unsigned long long args[1] = {C->second};
+      traceRecord(EV_MAX_PICKED, 1, args, transitionNames[C->first]);
+    }
+  }
+  if (!fireSuper(S)){return false;}
+  stats.phase(PHASE_FIRE, phaseStart);
+  stats.steps++;
+  return true;
+}
+
+/// \brief Evaluates every arc from scratch and sets all counters of the counters engine accordingly.
+void PetriCompiled::resetCounters(PetriState & S){
+  for (unsigned int w = 0; w < S.enabledBits.size(); ++w){S.enabledBits[w] = 0;}
+  for (unsigned int i = 0; i < S.enabledTree.size(); ++i){S.enabledTree[i] = 0;}
+  S.counterEnabled = 0;
+  S.counterTokens = S.tokens;
+  for (unsigned int t = 0; t < transitionIds.size(); ++t){
+    S.unsatisfied[t] = 0;
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1]; ++a){
+      S.arcOk[a] = arcHolds(a, S.tokens[arcPlace[a]]);
+      S.unsatisfied[t] += !S.arcOk[a];
+    }
+    if (!S.unsatisfied[t]){setEnabled(S, t, true);}
+  }
+}
+
+/// \brief Marks transition t as enabled or disabled, in the bitset and the Fenwick tree of weights (all 1 when unweighted).
+void PetriCompiled::setEnabled(PetriState & S, unsigned int t, bool enabled){
+  S.enabledBits[t >> 6] ^= 1ull << (t & 63);
+  unsigned long long w = weighted ? weights[t] : 1;
+  if (!enabled){w = 0ull - w;}
+  for (unsigned int i = t + 1; i < S.enabledTree.size(); i += i & (0u - i)){S.enabledTree[i] += w;}
+  if (enabled){
+    S.counterEnabled++;
+  }else{
+    S.counterEnabled--;
+  }
+}
+
+/// \brief Re-evaluates the range function of arc a for marking m, adjusting the counter of its transition if it flipped.
+inline void PetriCompiled::arcChanged(PetriState & S, unsigned int a, unsigned long long m){
+  unsigned char ok = arcHolds(a, m);
+  if (ok == S.arcOk[a]){return;}
+  S.arcOk[a] = ok;
+  S.arcFlips++;
+  unsigned int t = arcTransition[a];
+  if (ok){
+    if (!--S.unsatisfied[t]){setEnabled(S, t, true);}
+  }else{
+    if (!S.unsatisfied[t]++){setEnabled(S, t, false);}
+  }
+}
+
+/// \brief Brings the counters up to date with the marking of place p, which may have changed.
+///
+/// Going from marking m to m', an arc can only flip if its low bound lies in (min, max] or its high bound in [min, max)
+/// of the two markings. On places with many arcs those are found by binary search over the sorted thresholds, so a hub
+/// place moving by one token only touches the few arcs that actually flip. Arcs in both ranges are evaluated twice,
+/// which is harmless, since the second evaluation finds nothing changed.
+void PetriCompiled::placeChanged(PetriState & S, unsigned int p){
+  unsigned long long m = S.tokens[p], old = S.counterTokens[p];
+  if (m == old){return;}
+  S.counterTokens[p] = m;
+  unsigned int start = placeArcStart[p], end = placeArcStart[p + 1];
+  if (end - start < THRESHOLD_INDEX_MIN_ARCS){
+    for (unsigned int k = start; k < end; ++k){arcChanged(S, placeArc[k], m);}
+    return;
+  }
+  unsigned long long lo = (m < old) ? m : old, hi = (m < old) ? old : m;
+  const unsigned long long * key = &placeLowKey[0];
+  unsigned int first = std::upper_bound(key + start, key + end, lo) - key;
+  unsigned int last = std::upper_bound(key + first, key + end, hi) - key;
+  for (unsigned int k = first; k < last; ++k){arcChanged(S, placeLowArc[k], m);}
+  key = &placeHighKey[0];
+  first = std::lower_bound(key + start, key + end, lo) - key;
+  last = std::lower_bound(key + first, key + end, hi) - key;
+  for (unsigned int k = first; k < last; ++k){arcChanged(S, placeHighArc[k], m);}
+}
+
+/// \brief Does a single step on the counters engine, without looking at any transition that did not change.
+///
+/// The transition is found by descending the Fenwick tree of enabled weights, which picks exactly the transition
+/// the walk in pickFrom would pick from the ascending enabled list, for the same random number.
+bool PetriCompiled::stepCounters(PetriState & S, PetriStats & stats){
+  unsigned long long phaseStart = stats.begin();
+  stats.arcsEvaluated += S.arcFlips;
+  S.arcFlips = 0;
+  phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+  stats.enabledHistogram[PetriStats::bucket(S.counterEnabled)]++;
+  if (TRACE_ON(TRACE_STEP, 2)){
+    unsigned long long args[1] = {S.counterEnabled};
+    traceRecord(EV_SINGLE_ENABLED, 1, args);
+  }
+  if (!S.counterEnabled){return false;}
+  unsigned int size = S.enabledTree.size() - 1, t = 0;
+  unsigned long long total = S.counterEnabled;
+  if (weighted){
+    //The tree holds prefix sums, so the sum of all enabled weights is the prefix sum of the whole tree
+    total = 0;
+    for (unsigned int i = size; i; i -= i & (0u - i)){total += S.enabledTree[i];}
+  }
+  unsigned long long r = S.rng.below(total);
+  unsigned int bit = 1;
+  while (bit * 2 <= size){bit *= 2;}
+  for (; bit; bit >>= 1){
+    if (t + bit <= size && S.enabledTree[t + bit] <= r){
+      t += bit;
+      r -= S.enabledTree[t];
+    }
+  }
+  if (TRACE_ON(TRACE_STEP, 1)){
+    traceRecord(EV_SINGLE_PICKED, 0, 0, transitionNames[t]);
+  }
+  phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+  fire(S, t);
+  stats.phase(PHASE_FIRE, phaseStart);
+  stats.superHistogram[1]++;
+  stats.steps++;
+  return true;
+}
+
+/// \brief Does a single calculation step on a state keeping its marking in bits.
+///
+/// Makes exactly the same choices as step() would on tokens. If firing would make the marking unsafe, the state moves to tokens first.
+bool PetriCompiled::stepBits(int stepMode, PetriState & S, PetriStats & stats){
+  unsigned long long phaseStart = stats.begin();
+  scan(S, stats);
+  phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+  stats.enabledHistogram[PetriStats::bucket(S.enabledCount)]++;
+  if (TRACE_ON(TRACE_STEP, 2)){
+    unsigned long long args[1] = {S.enabledCount};
+    traceRecord((stepMode == SINGLE_STEP) ? EV_SINGLE_ENABLED : EV_MAX_ENABLED, 1, args);
+  }
+  if (!S.enabledCount){return false;}
+
+  if (stepMode == SINGLE_STEP){
+    unsigned int t = S.enabled[pick(S)];
+    if (TRACE_ON(TRACE_STEP, 1)){
+      traceRecord(EV_SINGLE_PICKED, 0, 0, transitionNames[t]);
+    }
+    phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+    bool unsafe = bitUnsafe[t];
+    for (unsigned int e = bitStart[t]; e < bitStart[t + 1] && !unsafe; ++e){
+      unsafe = (S.bits[bitWord[e]] & ~bitConsume[e] & ~bitSetter[e] & bitAdd[e]);
+    }
+    if (unsafe){
+      leaveBits(S, stats);
+      fire(S, t);
+    }else{
+      for (unsigned int e = bitStart[t]; e < bitStart[t + 1]; ++e){
+        unsigned long long & w = S.bits[bitWord[e]];
+        w = (bitSetter[e] & bitAdd[e]) | (~bitSetter[e] & ((w & ~bitConsume[e]) | bitAdd[e]));
+      }
+    }
+    stats.phase(PHASE_FIRE, phaseStart);
+    stats.superHistogram[1]++;
+    stats.steps++;
+    return true;
+  }
+
+  //Maximal auto-concurrent step: a transition fits as long as no token is used twice
+  S.chosen.clear();
+  unsigned int i = pick(S);
+  unsigned long long superSize = 0;
+  while (true){
+    unsigned int t = S.enabled[i];
+    for (unsigned int e = bitStart[t]; e < bitStart[t + 1]; ++e){
+      unsigned int w = bitWord[e];
+      if (!(S.superUsedBits[w] | S.superConsumeBits[w] | S.superAddBits[w] | S.superSetterBits[w])){S.touchedWords.push_back(w);}
+      S.superUsedBits[w] |= bitUsed[e];
+      S.superConsumeBits[w] |= bitConsume[e];
+      S.superTwiceBits[w] |= S.superAddBits[w] & bitAdd[e];
+      S.superAddBits[w] |= bitAdd[e];
+      S.superSetterBits[w] |= bitSetter[e];
+    }
+    S.chosen.push_back(t);
+    superSize++;
+    //Look for the next transition that fits
+    bool found = false;
+    while (S.enabledCount){
+      i = pick(S);
+      t = S.enabled[i];
+      stats.enabledChecks++;
+      stats.arcsEvaluated += bitStart[t + 1] - bitStart[t];
+      unsigned int e = bitStart[t];
+      for (; e < bitStart[t + 1]; ++e){
+        if (S.superUsedBits[bitWord[e]] & bitUsed[e]){break;}
+      }
+      if (e == bitStart[t + 1]){
+        found = true;
+        break;
+      }
+      removeEnabled(S, i);
+    }
+    if (!found){break;}
+  }
+  phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+  stats.superHistogram[PetriStats::bucket(superSize)]++;
+  if (TRACE_ON(TRACE_STEP, 1)){
+    std::map<unsigned int, unsigned long long> chosen;
+    for (unsigned int c = 0; c < S.chosen.size(); ++c){chosen[S.chosen[c]]++;}
+    std::map<unsigned int, unsigned long long>::iterator C;
+    for (C = chosen.begin(); C != chosen.end(); C++){
+      unsigned long long args[1] = {C->second};
+      traceRecord(EV_MAX_PICKED, 1, args, transitionNames[C->first]);
+    }
+  }
+  bool unsafe = false;
+  for (unsigned int c = 0; c < S.chosen.size() && !unsafe; ++c){unsafe = bitUnsafe[S.chosen[c]];}
+  for (unsigned int c = 0; c < S.touchedWords.size() && !unsafe; ++c){
+    unsigned int w = S.touchedWords[c];
+    unsafe = S.superTwiceBits[w] | (S.bits[w] & ~S.superConsumeBits[w] & ~S.superSetterBits[w] & S.superAddBits[w]);
+  }
+  for (unsigned int c = 0; c < S.touchedWords.size(); ++c){
+    unsigned int w = S.touchedWords[c];
+    if (!unsafe){
+      unsigned long long set = S.superSetterBits[w], add = S.superAddBits[w];
+      S.bits[w] = (set & add) | (~set & ((S.bits[w] & ~S.superConsumeBits[w]) | add));
+    }
+    S.superUsedBits[w] = 0;
+    S.superConsumeBits[w] = 0;
+    S.superAddBits[w] = 0;
+    S.superTwiceBits[w] = 0;
+    S.superSetterBits[w] = 0;
+  }
+  S.touchedWords.clear();
+  if (unsafe){
+    //Redo the combination on tokens, which can hold any amount
+    leaveBits(S, stats);
+    for (unsigned int c = 0; c < S.chosen.size(); ++c){add(S, S.chosen[c]);}
+    if (!fireSuper(S)){return false;}
+  }
+  stats.phase(PHASE_FIRE, phaseStart);
+  stats.steps++;
+  return true;
+}
@@ -0,0 +1,251 @@
+/// \file petriengine.h
+/// \brief PetriCalc compiled engine header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <vector>
+#include <map>
+#include <string>
+#include "petrirandom.h"
+#include "petristats.h"
+#include "petripool.h"
+
+class PetriArc;
+
+/// Arcs per scan chunk. At 20 bytes of arc data per arc, a chunk stays well within a per-core L2 cache.
+#define SCAN_CHUNK_ARCS 8192
+/// Nets with fewer arcs are scanned on a single thread, as handing out the work would take longer than the scan itself.
+#define PARALLEL_MIN_ARCS 32768
+/// Maximal steps with fewer enabled transitions grow their conflict components on a single thread.
+#define PARALLEL_MIN_ENABLED 256
+/// Jobs per thread when growing conflict components, so threads finishing early can take over work.
+#define COMPONENT_JOBS_PER_THREAD 4
+/// Places with at least this many arcs find the arcs a marking change flips by binary search over their sorted thresholds.
+#define THRESHOLD_INDEX_MIN_ARCS 64
+/// Scans between reorderings of the arcs while adaptive arc ordering is still counting failures.
+#define ADAPTIVE_REORDER_SCANS 1024
+/// Default amount of scans adaptive arc ordering counts failures for, before the order is fixed.
+#define ADAPTIVE_WARMUP_SCANS 65536
+
+//Special values of PetriCompiled::arcSpan32. All other values are the span itself.
+#define ARC_SPAN_OPEN 0xFFFFFFFFu ///< The arc has no upper bound, so its span is INFTY - low
+#define ARC_SPAN_WIDE 0xFFFFFFFEu ///< Low or span does not fit in 32 bits, arcLow32 is the index of the arc in arcWideLow and arcWideSpan
+
+//Ways to split up maximal auto-concurrent steps over threads
+#define SPLIT_NONE 0 ///< Grow a single super-transition, drawing the same random numbers as the map engine
+#define SPLIT_COMPONENTS 1 ///< Grow every conflict component separately, see PetriCompiled::stepComponents
+#define SPLIT_RESERVE 2 ///< Let every thread reserve tokens for its own share of the enabled transitions, see PetriCompiled::stepReserve
+
+#define ISA_SCALAR 1 ///< Portable C++ only
+#define ISA_AVX2 2 ///< AVX2 gathers and compares, 4 arcs at a time
+#define ISA_AVX512 3 ///< AVX-512 gathers and compares, 8 arcs at a time
+
+int detectIsa();
+int parseIsa(std::string name);
+std::string isaName(int isa);
+
+//Arc kinds of the kinds engine, in the order the arcs of a transition are stored.
+//Neighbouring kinds share a kernel: read and consume arcs both check a minimum, consume and produce arcs both add their effect.
+#define KIND_READ 0 ///< Checks m >= low, no effect
+#define KIND_CONSUME 1 ///< Checks m >= low, adds the effect
+#define KIND_PRODUCE 2 ///< No check, adds the effect
+#define KIND_RESET 3 ///< No check, sets m to the effect
+#define KIND_INHIBIT 4 ///< Checks m <= high, no effect
+#define KIND_EQUAL 5 ///< Checks m == low, no effect
+#define KIND_GENERAL 6 ///< Any other label, such as combined arcs: full range function and effect
+#define KIND_COUNT 7 ///< Amount of arc kinds
+
+/// Largest token count a marking of the given width in bits can hold.
+#define WIDTH_MAX(width) (((width) >= 64) ? ~0ull : ((1ull << (width)) - 1))
+
+//Checks a transition needs, as a bitmask. Transitions needing the same checks are scanned by the same kernel.
+#define CHECK_MIN 1 ///< Has read or consume arcs
+#define CHECK_MAX 2 ///< Has inhibit arcs
+#define CHECK_EQUAL 4 ///< Has equal arcs
+#define CHECK_GENERAL 8 ///< Has general arcs
+#define CHECK_COMBINATIONS 16 ///< Amount of check bitmasks
+
+void rangeBitsAvx2(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned long long * bits, unsigned int count);
+void rangeBitsAvx512(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned long long * bits, unsigned int count);
+
+/// \brief The mutable part of a simulation on a compiled net: marking, random number generator and scratch space.
+///
+/// All vectors are sized by PetriCompiled::initState, so stepping never allocates.
+class PetriState{
+  public:
+    PetriState();
+    std::vector<unsigned long long> tokens; ///< Marking, indexed by place index.
+    PetriRandom rng; ///< Random number generator used for all choices during stepping.
+    std::vector<unsigned int> enabled; ///< Enabled transition indices, in ascending order. Sized for all transitions, only the first enabledCount are valid.
+    unsigned int enabledCount; ///< Amount of enabled transitions.
+    std::vector<unsigned long long> rangeBits; ///< Range function result per arc, as a bitset.
+    std::vector<unsigned long long> superUsed; ///< Used range of the super-transition, per place.
+    std::vector<long long> superEffect; ///< Effect of the super-transition, per place.
+    std::vector<long long> superAdded; ///< Tokens added by the super-transition, per place.
+    std::vector<unsigned char> superSetter; ///< Whether the super-transition sets a place, per place.
+    std::vector<unsigned char> touched; ///< Whether the super-transition has an arc to a place, per place.
+    std::vector<unsigned int> touchedList; ///< Places the super-transition has an arc to.
+    std::vector<unsigned int> chosen; ///< Transitions combined into the super-transition, in order of choosing.
+    bool bitsActive; ///< True while the marking is kept in bits instead of tokens, see PetriCompiled::buildBits.
+    std::vector<unsigned long long> bits; ///< Marking as a bitset, while bitsActive.
+    std::vector<unsigned long long> superUsedBits; ///< Places whose token is used by the super-transition, per word.
+    std::vector<unsigned long long> superConsumeBits; ///< Places losing a token through the super-transition, per word.
+    std::vector<unsigned long long> superAddBits; ///< Places gaining at least one token through the super-transition, per word.
+    std::vector<unsigned long long> superTwiceBits; ///< Places gaining two or more tokens through the super-transition, per word.
+    std::vector<unsigned long long> superSetterBits; ///< Places set by the super-transition, per word.
+    std::vector<unsigned int> touchedWords; ///< Words touched by the super-transition.
+    std::vector<unsigned char> kindEnabled; ///< Enabledness per transition index, as found by the kinds engine scan.
+    unsigned int width; ///< Bits per token count of the marking: 8, 16 or 32 while kept in tokens8, tokens16 or tokens32, 64 while kept in tokens.
+    unsigned int widened; ///< Width the marking last grew to while stepping, 0 if it did not grow. Cleared by whoever reports it.
+    std::vector<unsigned char> tokens8; ///< Marking per place index while width is 8.
+    std::vector<unsigned short> tokens16; ///< Marking per place index while width is 16.
+    std::vector<unsigned int> tokens32; ///< Marking per place index while width is 32.
+    std::vector<unsigned int> chunkCount; ///< Enabled transitions found per scan chunk.
+    std::vector<unsigned long long> chunkArcs; ///< Arcs evaluated per scan chunk.
+    PetriPool * pool; ///< Threads scanning chunks or growing components in parallel, or null to work on the calling thread.
+    std::vector<unsigned int> compStart; ///< First entry in compList per conflict component, with one extra entry for the end.
+    std::vector<unsigned int> compList; ///< Enabled transitions sorted by conflict component, in ascending order within each component.
+    std::vector<unsigned int> activeComps; ///< Conflict components with at least one enabled transition, in ascending order.
+    std::vector<unsigned long long> compUsed; ///< Used range of the transitions chosen so far in their component, per place.
+    unsigned long long stepSeed; ///< Seed of the current maximal step, from which every component seeds its own generator.
+    std::vector<unsigned int> jobFirst; ///< First entry in activeComps per component job, with one extra entry for the end.
+    std::vector<std::vector<unsigned int> > jobChosen; ///< Transitions chosen per component job, in order of choosing.
+    std::vector<unsigned long long> jobChecks; ///< Enabledness checks per component job.
+    std::vector<unsigned long long> jobArcs; ///< Arcs evaluated per component job.
+    std::vector<unsigned long long> budget; ///< Tokens per place not yet reserved by the current maximal step, see PetriCompiled::stepReserve.
+    std::vector<unsigned char> arcOk; ///< Whether the range function of each arc holds, for the counters engine.
+    std::vector<unsigned int> unsatisfied; ///< Arcs whose range function does not hold, per transition, for the counters engine.
+    std::vector<unsigned long long> enabledBits; ///< Transitions whose unsatisfied count is zero, as a bitset.
+    std::vector<unsigned long long> enabledTree; ///< Fenwick tree over the weights of enabled transitions (1 each when unweighted), for picking without a list.
+    unsigned int counterEnabled; ///< Amount of enabled transitions, for the counters engine.
+    unsigned long long arcFlips; ///< Range functions that changed value since the last step, for the counters engine.
+    std::vector<unsigned long long> counterTokens; ///< Marking per place the counters were last brought up to date with.
+};
+
+/// \brief A net compiled into flat arrays, shared by all simulations of that net.
+///
+/// Places and transitions are numbered densely in order of ascending ID, so every engine makes the same choices as the map engine.
+/// Arcs are stored per transition as a structure of arrays, with arcStart[t] to arcStart[t + 1] being the arcs of transition t.
+/// The range function l <= m <= h and u <= m is stored as a single unsigned comparison m - low <= span, with low = max(l, u) and span = h - low.
+/// Low and span take 32 bits each, the span of arcs without upper bound is implied, and the rare arcs needing more bits are kept in a separate wide table.
+class PetriCompiled{
+  public:
+    PetriCompiled();
+    void build(int useEngine, int useIsa, unsigned int useThreads, std::map<unsigned long long, unsigned long long> & marking, std::map<unsigned long long, std::map<unsigned long long, PetriArc> > & arcs, std::map<unsigned long long, unsigned long long> & weights, std::map<unsigned long long, std::string> & names);
+    void initState(PetriState & S);
+    bool step(int stepMode, PetriState & S, PetriStats & stats);
+    unsigned int placeIndex(unsigned long long placeId);
+    int engine; ///< Engine this net was compiled for.
+    int isa; ///< Instruction set used for enabledness scans.
+    std::vector<unsigned long long> placeIds; ///< Place ID per place index.
+    std::vector<unsigned long long> initialTokens; ///< Initial marking per place index.
+    std::vector<unsigned long long> transitionIds; ///< Transition ID per transition index.
+    std::vector<const char *> transitionNames; ///< Transition name per transition index, for tracing.
+    std::vector<unsigned long long> weights; ///< Weight per transition index, see PetriNet::reduceTransitions.
+    bool weighted; ///< True if any transition has a weight other than 1.
+    std::vector<unsigned int> chunkStart; ///< First transition of each scan chunk, with one extra entry for the end.
+    std::vector<unsigned int> component; ///< Conflict component per transition index, see buildComponents.
+    unsigned int componentCount; ///< Amount of conflict components, 0 if maximal steps are not split into components.
+    int split; ///< How maximal auto-concurrent steps are split over threads, one of the SPLIT_ constants.
+    std::vector<unsigned int> placeArcStart; ///< First entry in placeArc per place, with one extra entry for the end.
+    std::vector<unsigned int> placeArc; ///< Arc indices, grouped by place.
+    std::vector<unsigned int> placeLowArc; ///< Like placeArc, but sorted by arcLow within each place.
+    std::vector<unsigned long long> placeLowKey; ///< arcLow of each entry in placeLowArc, for binary search.
+    std::vector<unsigned int> placeHighArc; ///< Like placeArc, but sorted by the highest enabling marking within each place.
+    std::vector<unsigned long long> placeHighKey; ///< Highest enabling marking of each entry in placeHighArc, for binary search.
+    std::vector<unsigned int> arcTransition; ///< Transition index per arc.
+    std::vector<unsigned int> chunkBitWord; ///< First word in PetriState::rangeBits of each scan chunk, with one extra entry for the end.
+    std::vector<unsigned int> arcStart; ///< First arc of each transition, with one extra entry for the end.
+    std::vector<unsigned int> arcPlace; ///< Place index per arc.
+    std::vector<unsigned int> arcLow32; ///< Lowest enabling marking per arc, or its wide table index if arcSpan32 is ARC_SPAN_WIDE.
+    std::vector<unsigned int> arcSpan32; ///< Highest enabling marking minus the lowest per arc, or one of the ARC_SPAN_ values.
+    std::vector<unsigned int> arcWideArc; ///< Arc index per wide table entry, ascending.
+    std::vector<unsigned long long> arcWideLow; ///< Lowest enabling marking per wide table entry.
+    std::vector<unsigned long long> arcWideSpan; ///< Highest enabling marking minus the lowest, per wide table entry.
+    /// Lowest enabling marking of arc a.
+    unsigned long long arcLow(unsigned int a) const{
+      return (arcSpan32[a] == ARC_SPAN_WIDE) ? arcWideLow[arcLow32[a]] : arcLow32[a];
+    }
+    /// Highest enabling marking minus the lowest, of arc a.
+    unsigned long long arcSpan(unsigned int a) const{
+      if (arcSpan32[a] == ARC_SPAN_WIDE){return arcWideSpan[arcLow32[a]];}
+      return (arcSpan32[a] == ARC_SPAN_OPEN) ? ~(unsigned long long)arcLow32[a] : arcSpan32[a];
+    }
+    /// True if the range function of arc a holds for marking m.
+    bool arcHolds(unsigned int a, unsigned long long m) const{
+      unsigned int span = arcSpan32[a];
+      if (__builtin_expect(span == ARC_SPAN_WIDE, 0)){return m - arcWideLow[arcLow32[a]] <= arcWideSpan[arcLow32[a]];}
+      unsigned long long low = arcLow32[a];
+      //INFTY - low is ~low
+      return m - low <= ((span == ARC_SPAN_OPEN) ? ~low : span);
+    }
+    std::vector<unsigned long long> arcUsed; ///< Used range per arc.
+    std::vector<long long> arcEffect; ///< Effect per arc.
+    std::vector<long long> arcAdded; ///< Tokens ever added per arc.
+    std::vector<unsigned char> arcSetter; ///< Whether the effect is a setter, per arc.
+    std::vector<unsigned long long> arcChecks; ///< Times each arc was evaluated by a scan stopping at the first failing arc, see adaptArcs.
+    std::vector<unsigned long long> arcFails; ///< Times each arc was the one that stopped such a scan.
+    unsigned long long adaptiveScans; ///< Scans left to count arc failures for, 0 once the arc order is fixed.
+    std::string profileFile; ///< File to write the arc profile to once adaptiveScans runs out, if any.
+    bool bitsSupported; ///< True if every arc can be expressed as bit masks, see buildBits.
+    std::vector<unsigned int> bitStart; ///< First mask entry of each transition, with one extra entry for the end.
+    std::vector<unsigned int> bitWord; ///< Marking word per mask entry.
+    std::vector<unsigned long long> bitPre; ///< Places that must be marked, per mask entry.
+    std::vector<unsigned long long> bitInhib; ///< Places that must be empty, per mask entry.
+    std::vector<unsigned long long> bitUsed; ///< Places whose token is used, per mask entry.
+    std::vector<unsigned long long> bitConsume; ///< Places losing a token, per mask entry.
+    std::vector<unsigned long long> bitAdd; ///< Places gaining a token, per mask entry.
+    std::vector<unsigned long long> bitSetter; ///< Places set to the amount of tokens added, per mask entry.
+    std::vector<unsigned char> bitDead; ///< Transitions that can never be enabled in a 1-safe marking.
+    std::vector<unsigned char> bitUnsafe; ///< Transitions that always make the marking unsafe when fired.
+    std::vector<unsigned int> kindStart; ///< First arc of each kind of each transition, at index transition * KIND_COUNT + kind, with one extra entry for the end.
+    std::vector<unsigned int> kindPlace; ///< Place index per kind arc.
+    std::vector<unsigned long long> kindValue; ///< Value checked per kind arc: low or high as the kind needs, or the arc index for general arcs.
+    std::vector<long long> kindEffect; ///< Effect per kind arc.
+    std::vector<unsigned int> kindGroupStart; ///< First entry in kindGroup per scan chunk and check bitmask, at index chunk * CHECK_COMBINATIONS + checks, with one extra entry for the end.
+    std::vector<unsigned int> kindGroup; ///< Transition indices, per scan chunk grouped by the checks they need.
+    std::vector<unsigned long long> kindChecks; ///< Amount of kind arcs with a check, per scan chunk.
+    unsigned int kindTotal[KIND_COUNT]; ///< Amount of arcs per kind.
+    unsigned int width; ///< Bits per token count the kinds engine starts with: 8, 16, 32 or 64, or 0 to pick the narrowest that fits the net.
+    bool conserving; ///< True if no transition can increase the total amount of tokens, so the initial total bounds every place.
+    unsigned long long tokenCount(PetriState & S, unsigned int p);
+    void syncTokens(PetriState & S);
+    void loadTokens(PetriState & S, unsigned int atLeast = 0);
+    void buildComponents();
+    void buildCounters();
+    void indexWideArcs();
+    void adaptArcs(unsigned long long warmupScans, std::string saveFile);
+    void reorderArcs();
+    bool saveArcProfile(std::string filename);
+    bool loadArcProfile(std::string filename);
+    unsigned int pickFrom(PetriRandom & rng, const unsigned int * list, unsigned int count);
+  private:
+    void scan(PetriState & S, PetriStats & stats);
+    void scanChunk(PetriState & S, unsigned int c);
+    static void scanJob(void * arg, unsigned int c);
+    unsigned int pick(PetriState & S);
+    bool canAdd(PetriState & S, unsigned int t);
+    void add(PetriState & S, unsigned int t);
+    void fire(PetriState & S, unsigned int t);
+    bool fireKinds(PetriState & S, unsigned int t);
+    bool fireSuper(PetriState & S);
+    bool fitSuper(PetriState & S);
+    void narrowTokens(PetriState & S, unsigned int atLeast);
+    void widen(PetriState & S);
+    void buildBits();
+    void buildKinds();
+    bool stepBits(int stepMode, PetriState & S, PetriStats & stats);
+    bool stepComponents(PetriState & S, PetriStats & stats);
+    void growComponents(PetriState & S, unsigned int job);
+    static void componentJob(void * arg, unsigned int job);
+    bool stepReserve(PetriState & S, PetriStats & stats);
+    bool stepCounters(PetriState & S, PetriStats & stats);
+    void resetCounters(PetriState & S);
+    void placeChanged(PetriState & S, unsigned int p);
+    void arcChanged(PetriState & S, unsigned int a, unsigned long long m);
+    void setEnabled(PetriState & S, unsigned int t, bool enabled);
+    void reserveSlice(PetriState & S, unsigned int job);
+    static void reserveJob(void * arg, unsigned int job);
+    void leaveBits(PetriState & S, PetriStats & stats);
+    std::map<unsigned long long, unsigned int> placeIndices; ///< Place index per place ID.
+};
@@ -0,0 +1,372 @@
+/// \file petriensemble.cpp
+/// \brief PetriCalc replica ensemble implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petriensemble.h"
+#include "petricalc.h"
+#include "petrinuma.h"
+#include <chrono>
+#include <thread>
+#include <math.h>
+
+/// \brief Creates an empty replica.
+PetriReplica::PetriReplica(){
+  seed = 0;
+  steps = 0;
+  width = 0;
+  widened = false;
+}
+
+/// \brief Creates a rule that runs every replica, with 95% confidence intervals once targets are added.
+PetriStopRule::PetriStopRule(){
+  confidence = 0.95;
+  wave = ENSEMBLE_WAVE;
+  timeAverage = false;
+}
+
+/// \brief Creates an estimate without values.
+PetriEstimate::PetriEstimate(){
+  count = 0;
+  mean = 0;
+  m2 = 0;
+}
+
+/// \brief Adds a value to the estimate.
+void PetriEstimate::add(double x){
+  count++;
+  double delta = x - mean;
+  mean += delta / count;
+  m2 += delta * (x - mean);
+}
+
+/// \brief Returns the sample variance of the values added, 0 with fewer than two values.
+double PetriEstimate::variance(){
+  return (count > 1) ? m2 / (count - 1) : 0;
+}
+
+/// \brief Returns the half width of the confidence interval of the mean, for the normal quantile z of the confidence level.
+double PetriEstimate::halfWidth(double z){
+  return count ? z * sqrt(variance() / count) : INFINITY;
+}
+
+/// \brief Deals the given amount of replicas round robin over the queues of threads on the given NUMA nodes, one node per thread.
+PetriScheduler::PetriScheduler(const std::vector<unsigned int> & workerNodes, unsigned int replicas) : queues(workerNodes.size()), locks(workerNodes.size()){
+  nodes = workerNodes;
+  batches = 0;
+  steals = 0;
+  remoteSteals = 0;
+  remaining = replicas;
+  for (unsigned int r = 0; r < replicas; ++r){queues[r % queues.size()].push_back(r);}
+}
+
+/// \brief Takes a replica to run for the given thread, from its own queue or stolen from another one.
+///
+/// If no replica is queued and wait is true, waits for a running replica to be put back.
+/// Returns false once every replica has stopped, or without waiting if no replica is queued and wait is false.
+bool PetriScheduler::take(unsigned int worker, unsigned int & replica, bool wait){
+  unsigned int tries = 0;
+  while (true){
+    {
+      std::lock_guard<std::mutex> lock(locks[worker]);
+      if (queues[worker].size()){
+        replica = queues[worker].back();
+        queues[worker].pop_back();
+        batches++;
+        return true;
+      }
+    }
+    //Steal from threads on the same node first, so the replica marking stays in local memory
+    for (unsigned int remote = 0; remote < 2; ++remote){
+      for (unsigned int i = 1; i < queues.size(); ++i){
+        unsigned int victim = (worker + i) % queues.size();
+        if ((nodes[victim] != nodes[worker]) != (bool)remote){continue;}
+        std::lock_guard<std::mutex> lock(locks[victim]);
+        if (queues[victim].size()){
+          replica = queues[victim].front();
+          queues[victim].pop_front();
+          batches++;
+          steals++;
+          if (remote){remoteSteals++;}
+          return true;
+        }
+      }
+    }
+    if (!wait || !remaining){return false;}
+    //Only long replicas are still running, so their next batch may take a while
+    if (++tries < POOL_SPIN){
+      std::this_thread::yield();
+    }else{
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+}
+
+/// \brief Puts a replica that has not stopped yet back on the queue of the given thread.
+void PetriScheduler::put(unsigned int worker, unsigned int replica){
+  std::lock_guard<std::mutex> lock(locks[worker]);
+  queues[worker].push_back(replica);
+}
+
+/// \brief Marks a taken replica as stopped, it will not be put back.
+void PetriScheduler::done(){
+  remaining--;
+}
+
+/// \brief Prepares running replicas of the given net, which must be compiled and stay unchanged while the ensemble exists.
+///
+/// The token counts of the places in trackedPlaces are summed over every step of every replica, see PetriReplica::sums.
+PetriEnsemble::PetriEnsemble(PetriCompiled & net, const std::vector<unsigned int> & trackedPlaces) : C(net), tracked(trackedPlaces){
+  for (unsigned int a = 0; a < C.arcPlace.size(); ++a){
+    laneLow.push_back(C.arcLow(a));
+    laneSpan.push_back(C.arcSpan(a));
+  }
+  for (unsigned int l = 0; l < ENSEMBLE_LANES; ++l){
+    enabled[l].assign(C.transitionIds.size(), 0);
+    steps[l] = 0;
+    batchEnd[l] = 0;
+    replica[l] = 0;
+  }
+  tokens.assign(C.placeIds.size() * ENSEMBLE_LANES, 0);
+  masks.assign(C.transitionIds.size(), 0);
+}
+
+/// Arguments of PetriEnsemble::job.
+struct EnsembleJob{
+  PetriCompiled * net; ///< Net all replicas run on.
+  std::vector<unsigned int> tracked; ///< Places whose token counts are summed over every step.
+  bool numa; ///< Whether threads are placed on NUMA nodes, each node with its own copy of the net.
+  std::vector<unsigned int> workerNodes; ///< NUMA node per thread.
+  std::vector<std::vector<unsigned int> > nodeCpus; ///< CPUs per NUMA node.
+  std::vector<PetriCompiled *> nodeNets; ///< Copy of the net per NUMA node, made by the first thread on that node.
+  std::vector<std::mutex> * nodeLocks; ///< Guards making the copy per NUMA node.
+  int stepMode; ///< Step mode of all replicas.
+  bool lockstep; ///< Whether to step replicas together in lanes.
+  std::vector<PetriReplica> * replicas; ///< All replicas.
+  unsigned long long maxSteps; ///< Step limit per replica, 0 for none.
+  PetriScheduler * queue; ///< Scheduler handing out the replicas.
+  std::vector<PetriStats> * stats; ///< Statistics per thread.
+};
+
+/// \brief Thread pool job running replicas for a single thread until every replica has stopped.
+///
+/// With NUMA placement, the thread first moves to the CPUs of its node, so everything it allocates from then on is local.
+void PetriEnsemble::job(void * arg, unsigned int worker){
+  EnsembleJob * J = (EnsembleJob *)arg;
+  PetriCompiled * net = J->net;
+  std::vector<unsigned int> cpus;
+  if (J->numa){
+    unsigned int node = J->workerNodes[worker];
+    threadCpus(cpus);
+    pinThread(J->nodeCpus[node]);
+    std::lock_guard<std::mutex> lock((*J->nodeLocks)[node]);
+    if (!J->nodeNets[node]){J->nodeNets[node] = new PetriCompiled(*J->net);}
+    net = J->nodeNets[node];
+  }
+  {
+    PetriEnsemble E(*net, J->tracked);
+    if (J->lockstep){
+      E.runLockstep(*J->replicas, J->maxSteps, *J->queue, worker, (*J->stats)[worker]);
+    }else{
+      PetriState S;
+      net->initState(S);
+      E.runSerial(J->stepMode, S, *J->replicas, J->maxSteps, *J->queue, worker, (*J->stats)[worker]);
+    }
+  }
+  //Pool threads, and the calling thread, run anywhere again afterwards
+  if (cpus.size()){pinThread(cpus);}
+}
+
+/// \brief Runs all replicas from their initial marking and seed until they stop, on the given amount of threads.
+///
+/// Replicas run in batches of ENSEMBLE_BATCH_STEPS steps, handed out by a PetriScheduler, so threads that run out of replicas
+/// take over the remaining batches of long ones. Results do not depend on the amount of threads.
+/// With numa, threads are spread evenly over the NUMA nodes in contiguous blocks, and every node gets its own copy of the net.
+/// The token counts of trackedPlaces are summed over every step into PetriReplica::sums.
+/// The statistics of all threads are added to stats. With report, thread placement and scheduling counts are printed to stderr.
+void PetriEnsemble::run(PetriCompiled & net, int stepMode, bool lockstep, unsigned int threads, bool numa, const std::vector<unsigned int> & trackedPlaces, std::vector<PetriReplica> & replicas, unsigned long long maxSteps, PetriStats & stats, bool report){
+  //Markings are made by the thread first running each replica, so they live on its node
+  for (unsigned int r = 0; r < replicas.size(); ++r){
+    replicas[r].steps = 0;
+    replicas[r].width = 0;
+    replicas[r].widened = false;
+    replicas[r].tokens.clear();
+    replicas[r].rng.seed(replicas[r].seed);
+  }
+  EnsembleJob J;
+  J.tracked = trackedPlaces;
+  J.numa = false;
+  J.workerNodes.assign(threads, 0);
+  if (numa){
+    if (!numaNodes(J.nodeCpus)){
+      if (report){fprintf(stderr, "Could not read the NUMA topology, threads are not placed\n");}
+    }else{
+      unsigned int nodes = J.nodeCpus.size();
+      for (unsigned int w = 0; w < threads; ++w){J.workerNodes[w] = (unsigned long long)w * nodes / threads;}
+      J.numa = true;
+      J.nodeNets.assign(nodes, 0);
+      if (report){fprintf(stderr, "Placing %u threads on %u NUMA nodes, with a copy of the net per node\n", threads, (threads < nodes) ? threads : nodes);}
+    }
+  }
+  std::vector<std::mutex> nodeLocks(J.nodeCpus.size());
+  J.nodeLocks = &nodeLocks;
+  PetriScheduler queue(J.workerNodes, replicas.size());
+  std::vector<PetriStats> workerStats(threads);
+  J.net = &net;
+  J.stepMode = stepMode;
+  J.lockstep = lockstep;
+  J.replicas = &replicas;
+  J.maxSteps = maxSteps;
+  J.queue = &queue;
+  J.stats = &workerStats;
+  if (threads > 1){
+    PetriPool pool(threads);
+    pool.run(threads, job, &J);
+  }else{
+    job(&J, 0);
+  }
+  for (unsigned int w = 0; w < threads; ++w){stats.add(workerStats[w]);}
+  for (unsigned int n = 0; n < J.nodeNets.size(); ++n){delete J.nodeNets[n];}
+  if (report && threads > 1){
+    fprintf(stderr, "Ran %u replicas on %u threads in %llu batches, %llu of them stolen", (unsigned int)replicas.size(), threads, (unsigned long long)queue.batches, (unsigned long long)queue.steals);
+    if (J.numa){fprintf(stderr, ", %llu from another node", (unsigned long long)queue.remoteSteals);}
+    fprintf(stderr, "\n");
+  }
+}
+
+/// \brief Runs replicas taken from the scheduler one at a time on the state S, using the engine the net was compiled for.
+///
+/// Each replica continues from its marking and generator for at most ENSEMBLE_BATCH_STEPS steps, and stops when no transitions
+/// are enabled or after maxSteps steps in total (0 is no limit).
+void PetriEnsemble::runSerial(int stepMode, PetriState & S, std::vector<PetriReplica> & replicas, unsigned long long maxSteps, PetriScheduler & queue, unsigned int worker, PetriStats & stats){
+  unsigned int r;
+  while (queue.take(worker, r, true)){
+    PetriReplica & R = replicas[r];
+    prepare(R);
+    S.tokens = R.tokens;
+    //Continue at the width the replica already grew to, rather than growing again every batch
+    C.loadTokens(S, R.width);
+    S.widened = 0;
+    S.rng = R.rng;
+    unsigned long long end = R.steps + ENSEMBLE_BATCH_STEPS;
+    if (maxSteps && end > maxSteps){end = maxSteps;}
+    bool stopped = false;
+    while (R.steps < end){
+      if (!C.step(stepMode, S, stats)){
+        stopped = true;
+        break;
+      }
+      R.steps++;
+      for (unsigned int i = 0; i < tracked.size(); ++i){R.sums[i] += C.tokenCount(S, tracked[i]);}
+    }
+    C.syncTokens(S);
+    R.tokens = S.tokens;
+    R.width = S.width;
+    if (S.widened){R.widened = true;}
+    R.rng = S.rng;
+    if (stopped || (maxSteps && R.steps == maxSteps)){
+      queue.done();
+    }else{
+      queue.put(worker, r);
+    }
+  }
+}
+
+/// \brief Gives replica R the initial marking if it has not run yet.
+void PetriEnsemble::prepare(PetriReplica & R){
+  if (!R.tokens.empty()){return;}
+  R.tokens = C.initialTokens;
+  R.sums.resize(tracked.size());
+  for (unsigned int i = 0; i < tracked.size(); ++i){R.sums[i] = C.initialTokens[tracked[i]];}
+}
+
+/// \brief Continues replica R in the given lane, from its marking and generator.
+void PetriEnsemble::startLane(unsigned int lane, PetriReplica & R){
+  prepare(R);
+  for (unsigned int p = 0; p < C.placeIds.size(); ++p){tokens[p * ENSEMBLE_LANES + lane] = R.tokens[p];}
+  rng[lane] = R.rng;
+  steps[lane] = R.steps;
+  batchEnd[lane] = R.steps + ENSEMBLE_BATCH_STEPS;
+}
+
+/// \brief Stores the marking, generator and step count of the given lane in R.
+void PetriEnsemble::saveLane(unsigned int lane, PetriReplica & R){
+  R.steps = steps[lane];
+  R.rng = rng[lane];
+  for (unsigned int p = 0; p < C.placeIds.size(); ++p){R.tokens[p] = tokens[p * ENSEMBLE_LANES + lane];}
+}
+
+/// \brief Runs single steps of up to ENSEMBLE_LANES replicas taken from the scheduler at once, with their markings interleaved.
+///
+/// Every step evaluates the arcs of each transition for all lanes with a single compare, and fires the transitions chosen
+/// by several lanes with a single masked add. Each lane picks from its own enabled list with its own generator,
+/// exactly as PetriCompiled::step does, so results match runSerial. Lanes whose replica stops or finishes its batch take the next replica.
+void PetriEnsemble::runLockstep(std::vector<PetriReplica> & replicas, unsigned long long maxSteps, PetriScheduler & queue, unsigned int worker, PetriStats & stats){
+  unsigned int transitions = C.transitionIds.size(), active = 0;
+  unsigned int chosen[ENSEMBLE_LANES];
+  while (true){
+    //Fill idle lanes, only waiting for replicas to be put back by other threads if every lane is idle
+    for (unsigned int l = 0; l < ENSEMBLE_LANES; ++l){
+      if (active & (1u << l)){continue;}
+      if (!queue.take(worker, replica[l], !active)){break;}
+      startLane(l, replicas[replica[l]]);
+      active |= 1u << l;
+    }
+    if (!active){return;}
+    unsigned long long phaseStart = stats.begin();
+    switch (C.isa){
+      case ISA_AVX512: laneScanAvx512(&C.arcStart[0], &C.arcPlace[0], &laneLow[0], &laneSpan[0], &tokens[0], active, transitions, &masks[0]); break;
+      case ISA_AVX2: laneScanAvx2(&C.arcStart[0], &C.arcPlace[0], &laneLow[0], &laneSpan[0], &tokens[0], active, transitions, &masks[0]); break;
+      default: laneScanScalar(&C.arcStart[0], &C.arcPlace[0], &laneLow[0], &laneSpan[0], &tokens[0], active, transitions, &masks[0]); break;
+    }
+    unsigned int counts[ENSEMBLE_LANES] = {0};
+    for (unsigned int t = 0; t < transitions; ++t){
+      for (unsigned int m = masks[t]; m; m &= m - 1){
+        unsigned int l = __builtin_ctz(m);
+        enabled[l][counts[l]++] = t;
+      }
+    }
+    phaseStart = stats.phase(PHASE_SCAN, phaseStart);
+    //Pick per lane, handing back lanes whose replica stopped or finished its batch
+    unsigned int firing = 0;
+    for (unsigned int l = 0; l < ENSEMBLE_LANES; ++l){
+      if (!(active & (1u << l))){continue;}
+      bool stopped = !counts[l] || (maxSteps && steps[l] == maxSteps);
+      if (!stopped && steps[l] < batchEnd[l]){
+        stats.enabledHistogram[PetriStats::bucket(counts[l])]++;
+        chosen[l] = enabled[l][C.pickFrom(rng[l], &enabled[l][0], counts[l])];
+        firing |= 1u << l;
+        continue;
+      }
+      saveLane(l, replicas[replica[l]]);
+      if (stopped){
+        queue.done();
+      }else{
+        queue.put(worker, replica[l]);
+      }
+      active &= ~(1u << l);
+    }
+    phaseStart = stats.phase(PHASE_SELECT, phaseStart);
+    //Fire every chosen transition once, in all lanes that chose it
+    for (unsigned int left = firing; left; ){
+      unsigned int t = chosen[__builtin_ctz(left)], lanes = 0;
+      for (unsigned int m = left; m; m &= m - 1){
+        unsigned int l = __builtin_ctz(m);
+        if (chosen[l] == t){lanes |= 1u << l;}
+      }
+      if (C.isa == ISA_AVX512){
+        laneFireAvx512(&C.arcPlace[0], &C.arcEffect[0], &C.arcSetter[0], &tokens[0], C.arcStart[t], C.arcStart[t + 1], lanes);
+      }else{
+        laneFireScalar(&C.arcPlace[0], &C.arcEffect[0], &C.arcSetter[0], &tokens[0], C.arcStart[t], C.arcStart[t + 1], lanes);
+      }
+      left &= ~lanes;
+    }
+    for (unsigned int m = firing; m; m &= m - 1){
+      unsigned int l = __builtin_ctz(m);
+      steps[l]++;
+      for (unsigned int i = 0; i < tracked.size(); ++i){replicas[replica[l]].sums[i] += tokens[tracked[i] * ENSEMBLE_LANES + l];}
+    }
+    stats.phase(PHASE_FIRE, phaseStart);
+    stats.superHistogram[1] += __builtin_popcount(firing);
+    stats.steps += __builtin_popcount(firing);
+  }
+}
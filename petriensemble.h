@@ -0,0 +1,113 @@
+/// \file petriensemble.h
+/// \brief PetriCalc replica ensemble header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <vector>
+#include <map>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include "petriengine.h"
+#include "petristats.h"
+#include "petrirandom.h"
+
+/// Replicas stepped together by the lockstep engine, one per 64-bit lane of an AVX-512 register.
+#define ENSEMBLE_LANES 8
+/// Steps a replica runs before going back to its queue, so idle threads can take over the rest of long replicas.
+#define ENSEMBLE_BATCH_STEPS 65536
+/// Default amount of replicas run between checks of a PetriStopRule.
+#define ENSEMBLE_WAVE 64
+/// Replicas needed before a PetriStopRule may stop a run, so the normal approximation of the intervals holds.
+#define ENSEMBLE_MIN_REPLICAS 30
+
+void laneScanScalar(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks);
+void laneScanAvx2(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks);
+void laneScanAvx512(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks);
+void laneFireScalar(const unsigned int * place, const long long * effect, const unsigned char * setter, unsigned long long * tokens, unsigned int start, unsigned int end, unsigned int lanes);
+void laneFireAvx512(const unsigned int * place, const long long * effect, const unsigned char * setter, unsigned long long * tokens, unsigned int start, unsigned int end, unsigned int lanes);
+
+/// \brief A single replica of an ensemble run: where it is, and eventually how it ended.
+class PetriReplica{
+  public:
+    PetriReplica();
+    unsigned long long seed; ///< Seed of the random number generator of the replica.
+    unsigned long long steps; ///< Steps completed.
+    std::vector<unsigned long long> tokens; ///< Marking after the completed steps, indexed by place index.
+    PetriRandom rng; ///< Random number generator after the completed steps, so the replica can continue on any thread.
+    unsigned int width; ///< Bits per token count the marking was kept in, so the kinds engine continues at that width. 0 before running.
+    bool widened; ///< Whether the marking had to grow to a wider token count while stepping.
+    std::vector<double> sums; ///< Per tracked place, the sum of its token counts over the initial marking and the marking after every step.
+};
+
+/// \brief When an ensemble run may stop before running every replica: once the confidence interval of every target place is narrow enough.
+class PetriStopRule{
+  public:
+    PetriStopRule();
+    std::map<std::string, double> targets; ///< Largest allowed half width of the confidence interval, per place name. Empty to run every replica.
+    double confidence; ///< Confidence level of the intervals, such as 0.95.
+    unsigned int wave; ///< Replicas run between checks.
+    bool timeAverage; ///< Whether to estimate the time-averaged marking of the target places, instead of their final marking.
+};
+
+/// \brief Running mean and variance of a series of values, using Welford's method so it stays accurate over many values.
+class PetriEstimate{
+  public:
+    PetriEstimate();
+    void add(double x);
+    double variance();
+    double halfWidth(double z);
+    unsigned long long count; ///< Values added.
+    double mean; ///< Mean of the values added.
+  private:
+    double m2; ///< Sum of squared differences from the mean.
+};
+
+/// \brief Hands out replicas to the threads of an ensemble run, as a queue of replicas per thread.
+///
+/// A thread takes the replica it put back last from its own queue, so a replica usually keeps running on the same thread.
+/// Threads with an empty queue steal the oldest replica from another queue, trying threads on their own NUMA node first.
+class PetriScheduler{
+  public:
+    PetriScheduler(const std::vector<unsigned int> & workerNodes, unsigned int replicas);
+    bool take(unsigned int worker, unsigned int & replica, bool wait);
+    void put(unsigned int worker, unsigned int replica);
+    void done();
+    std::atomic<unsigned long long> batches; ///< Replicas or parts of replicas taken.
+    std::atomic<unsigned long long> steals; ///< Replicas taken from the queue of another thread.
+    std::atomic<unsigned long long> remoteSteals; ///< Replicas taken from the queue of a thread on another NUMA node.
+  private:
+    std::vector<unsigned int> nodes; ///< NUMA node per thread, all 0 when threads are not placed.
+    std::vector<std::deque<unsigned int> > queues; ///< Replicas waiting to run, per thread.
+    std::vector<std::mutex> locks; ///< Guards each queue.
+    std::atomic<unsigned int> remaining; ///< Replicas that have not stopped yet, queued or running.
+};
+
+/// \brief Runs replicas of a compiled net on a single thread, each from the initial marking with its own seed.
+///
+/// Every replica ends exactly as a single run with its seed would after the same amount of steps.
+/// Replicas run ENSEMBLE_BATCH_STEPS steps at a time, after which they go back to the scheduler.
+class PetriEnsemble{
+  public:
+    PetriEnsemble(PetriCompiled & net, const std::vector<unsigned int> & trackedPlaces);
+    static void run(PetriCompiled & net, int stepMode, bool lockstep, unsigned int threads, bool numa, const std::vector<unsigned int> & trackedPlaces, std::vector<PetriReplica> & replicas, unsigned long long maxSteps, PetriStats & stats, bool report);
+    void runSerial(int stepMode, PetriState & S, std::vector<PetriReplica> & replicas, unsigned long long maxSteps, PetriScheduler & queue, unsigned int worker, PetriStats & stats);
+    void runLockstep(std::vector<PetriReplica> & replicas, unsigned long long maxSteps, PetriScheduler & queue, unsigned int worker, PetriStats & stats);
+  private:
+    static void job(void * arg, unsigned int worker);
+    void prepare(PetriReplica & R);
+    void startLane(unsigned int lane, PetriReplica & R);
+    void saveLane(unsigned int lane, PetriReplica & R);
+    PetriCompiled & C; ///< Net all replicas run on.
+    std::vector<unsigned int> tracked; ///< Places whose token counts are summed over every step, see PetriReplica::sums.
+    std::vector<unsigned long long> laneLow; ///< Lowest enabling marking per arc, as a full 64-bit value.
+    std::vector<unsigned long long> laneSpan; ///< Highest enabling marking minus the lowest per arc, as a full 64-bit value.
+    std::vector<unsigned long long> tokens; ///< Markings of all lanes interleaved, at index place * ENSEMBLE_LANES + lane.
+    std::vector<unsigned char> masks; ///< Lanes in which each transition is enabled, as a bitmask.
+    std::vector<unsigned int> enabled[ENSEMBLE_LANES]; ///< Enabled transitions per lane, in ascending order.
+    PetriRandom rng[ENSEMBLE_LANES]; ///< Random number generator per lane.
+    unsigned long long steps[ENSEMBLE_LANES]; ///< Steps completed per lane.
+    unsigned long long batchEnd[ENSEMBLE_LANES]; ///< Step count at which each lane hands its replica back to the scheduler.
+    unsigned int replica[ENSEMBLE_LANES]; ///< Replica running in each lane.
+};
@@ -0,0 +1,248 @@
+/// \file petrigen.cpp
+/// \brief Synthetic Snoopy net generator implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petrigen.h"
+#include <math.h>
+
+/// Snoopy edge class names, indexed by edgeType.
+static const char * edgeClassNames[5] = {"Edge", "Read Edge", "Inhibitor Edge", "Reset Edge", "Equal Edge"};
+
+/// \brief Creates an empty generator, using the given seed for the random families.
+PetriGenerator::PetriGenerator(unsigned long long seed){
+  rng.seed(seed);
+  tokens = 0;
+  transitionCount = 0;
+}
+
+/// \brief Returns a human readable, comma-separated list of all supported families.
+std::string PetriGenerator::families(){
+  return "chain, forkjoin, grid, philosophers, scalefree, kinetics";
+}
+
+/// \brief Returns the amount of places generated.
+unsigned long long PetriGenerator::places(){
+  return placeTokens.size();
+}
+
+/// \brief Returns the amount of transitions generated.
+unsigned int PetriGenerator::transitions(){
+  return transitionCount;
+}
+
+/// \brief Returns the node ID that write gives to transition index 0. Transition index i gets node ID transitionIdBase() + i.
+unsigned long long PetriGenerator::transitionIdBase(){
+  return placeTokens.size() + 1;
+}
+
+/// \brief Adds a place with the given initial marking, returning its index.
+unsigned int PetriGenerator::addPlace(unsigned long long tokens){
+  placeTokens.push_back(tokens);
+  return placeTokens.size() - 1;
+}
+
+/// \brief Adds a transition, returning its index.
+unsigned int PetriGenerator::addTransition(){
+  return transitionCount++;
+}
+
+/// \brief Adds an arc of the given edgeType between a place and a transition.
+void PetriGenerator::addArc(unsigned int edgeType, unsigned int place, unsigned int transition, unsigned int multiplicity, bool toPlace){
+  PetriGenArc A;
+  A.place = place;
+  A.transition = transition;
+  A.multiplicity = multiplicity;
+  A.toPlace = toPlace;
+  arcs[edgeType].push_back(A);
+}
+
+/// \brief Generates a net of the given family with approximately size nodes (places plus transitions).
+///
+/// Returns false if the family is unknown.
+bool PetriGenerator::generate(std::string family, unsigned long long size){
+  if (size < 10){size = 10;}
+  if (family == "chain"){chain(size); return true;}
+  if (family == "forkjoin"){forkJoin(size); return true;}
+  if (family == "grid"){grid(size); return true;}
+  if (family == "philosophers"){philosophers(size); return true;}
+  if (family == "scalefree"){scaleFree(size); return true;}
+  if (family == "kinetics"){kinetics(size); return true;}
+  return false;
+}
+
+/// \brief A ring of places and transitions, passing tokens along.
+///
+/// All tokens start in the first place.
+void PetriGenerator::chain(unsigned long long size){
+  unsigned int k = size / 2;
+  for (unsigned int i = 0; i < k; ++i){addPlace(i ? 0 : (tokens ? tokens : 1));}
+  for (unsigned int i = 0; i < k; ++i){
+    unsigned int t = addTransition();
+    addArc(EDGE_NORMAL, i, t, 1, false);
+    addArc(EDGE_NORMAL, (i + 1) % k, t, 1, true);
+  }
+}
+
+/// \brief A fork transition splitting into parallel branches of equal length, synchronised again by a join transition.
+///
+/// The join transition returns the token to the start place, so the net runs forever.
+void PetriGenerator::forkJoin(unsigned long long size){
+  unsigned int branches = sqrt(size / 2.0);
+  if (branches < 2){branches = 2;}
+  unsigned int length = size / (2 * branches);
+  if (length < 1){length = 1;}
+  unsigned int start = addPlace(tokens ? tokens : 1);
+  unsigned int fork = addTransition();
+  unsigned int join = addTransition();
+  addArc(EDGE_NORMAL, start, fork, 1, false);
+  addArc(EDGE_NORMAL, start, join, 1, true);
+  for (unsigned int b = 0; b < branches; ++b){
+    unsigned int prev = addPlace(0);
+    addArc(EDGE_NORMAL, prev, fork, 1, true);
+    for (unsigned int l = 1; l < length; ++l){
+      unsigned int next = addPlace(0);
+      unsigned int t = addTransition();
+      addArc(EDGE_NORMAL, prev, t, 1, false);
+      addArc(EDGE_NORMAL, next, t, 1, true);
+      prev = next;
+    }
+    addArc(EDGE_NORMAL, prev, join, 1, false);
+  }
+}
+
+/// \brief A square torus of places, with transitions moving tokens right and down.
+///
+/// About a quarter of the places start with a token.
+void PetriGenerator::grid(unsigned long long size){
+  unsigned int w = sqrt(size / 3.0);
+  if (w < 2){w = 2;}
+  for (unsigned int i = 0; i < w * w; ++i){addPlace(rng.below(4) ? 0 : (tokens ? tokens : 1));}
+  for (unsigned int y = 0; y < w; ++y){
+    for (unsigned int x = 0; x < w; ++x){
+      unsigned int p = y * w + x;
+      unsigned int right = addTransition();
+      addArc(EDGE_NORMAL, p, right, 1, false);
+      addArc(EDGE_NORMAL, y * w + (x + 1) % w, right, 1, true);
+      unsigned int down = addTransition();
+      addArc(EDGE_NORMAL, p, down, 1, false);
+      addArc(EDGE_NORMAL, ((y + 1) % w) * w + x, down, 1, true);
+    }
+  }
+}
+
+/// \brief The dining philosophers: each philosopher needs both neighbouring forks to eat.
+void PetriGenerator::philosophers(unsigned long long size){
+  unsigned int k = size / 5;
+  if (k < 2){k = 2;}
+  for (unsigned int i = 0; i < k; ++i){
+    addPlace(1);//thinking
+    addPlace(0);//eating
+    addPlace(1);//fork
+  }
+  for (unsigned int i = 0; i < k; ++i){
+    unsigned int think = 3 * i, eat = 3 * i + 1, left = 3 * i + 2, right = 3 * ((i + 1) % k) + 2;
+    unsigned int take = addTransition();
+    addArc(EDGE_NORMAL, think, take, 1, false);
+    addArc(EDGE_NORMAL, left, take, 1, false);
+    addArc(EDGE_NORMAL, right, take, 1, false);
+    addArc(EDGE_NORMAL, eat, take, 1, true);
+    unsigned int release = addTransition();
+    addArc(EDGE_NORMAL, eat, release, 1, false);
+    addArc(EDGE_NORMAL, think, release, 1, true);
+    addArc(EDGE_NORMAL, left, release, 1, true);
+    addArc(EDGE_NORMAL, right, release, 1, true);
+  }
+}
+
+/// \brief A random net in which places are connected by preferential attachment, giving a scale-free degree distribution.
+///
+/// Every transition moves a token from one place to another, and additionally has on average one extra arc of a random type.
+/// The extra arcs are read, inhibitor, equal, reset or additional output arcs.
+void PetriGenerator::scaleFree(unsigned long long size){
+  unsigned int P = size / 2, T = size - P;
+  std::vector<unsigned int> endpoints;//every place once, plus once per connected arc
+  endpoints.reserve(P + 3 * (unsigned long long)T);
+  for (unsigned int i = 0; i < P; ++i){
+    addPlace(tokens ? tokens : 1 + rng.below(3));
+    endpoints.push_back(i);
+  }
+  for (unsigned int i = 0; i < T; ++i){
+    unsigned int t = addTransition();
+    unsigned int in = endpoints[rng.below(endpoints.size())];
+    unsigned int out = endpoints[rng.below(endpoints.size())];
+    addArc(EDGE_NORMAL, in, t, 1, false);
+    addArc(EDGE_NORMAL, out, t, 1, true);
+    endpoints.push_back(in);
+    endpoints.push_back(out);
+    while (rng.below(2)){
+      unsigned int p = endpoints[rng.below(endpoints.size())];
+      unsigned int kind = rng.below(20);
+      if (kind < 8){
+        addArc(EDGE_ACTIVATOR, p, t, 1 + rng.below(2), false);
+      }else if (kind < 13){
+        addArc(EDGE_INHIBITOR, p, t, 3 + rng.below(6), false);
+      }else if (kind < 15){
+        addArc(EDGE_EQUAL, p, t, rng.below(3), false);
+      }else if (kind < 16){
+        addArc(EDGE_RESET, p, t, 1, false);
+      }else{
+        addArc(EDGE_NORMAL, p, t, 1, true);
+      }
+      endpoints.push_back(p);
+    }
+  }
+}
+
+/// \brief Reversible reactions between species with high token counts, as found in kinetics models.
+///
+/// Each reaction consumes one or two species and produces a third, and has a reverse reaction undoing it.
+void PetriGenerator::kinetics(unsigned long long size){
+  unsigned int P = size / 3;
+  unsigned int R = (size - P) / 2;
+  unsigned long long base = tokens ? tokens : 1000000;
+  for (unsigned int i = 0; i < P; ++i){addPlace(base / 2 + rng.below(base));}
+  for (unsigned int i = 0; i < R; ++i){
+    unsigned int a = rng.below(P), b = rng.below(P), c = rng.below(P);
+    unsigned int ma = 1 + rng.below(2), mc = 1 + rng.below(2);
+    bool twoInputs = rng.below(2);
+    unsigned int forward = addTransition();
+    unsigned int reverse = addTransition();
+    addArc(EDGE_NORMAL, a, forward, ma, false);
+    addArc(EDGE_NORMAL, a, reverse, ma, true);
+    if (twoInputs){
+      addArc(EDGE_NORMAL, b, forward, 1, false);
+      addArc(EDGE_NORMAL, b, reverse, 1, true);
+    }
+    addArc(EDGE_NORMAL, c, forward, mc, true);
+    addArc(EDGE_NORMAL, c, reverse, mc, false);
+  }
+}
+
+/// \brief Writes the generated net to the given file in Snoopy format.
+///
+/// Places get node IDs starting at 1, transitions directly follow the places and edges directly follow the transitions.
+void PetriGenerator::write(FILE * out){
+  unsigned long long P = placeTokens.size();
+  unsigned long long nextId = P + transitionCount + 1;
+  fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Snoopy version=\"2\" revision=\"1.21\">\n");
+  fprintf(out, "  <netclass name=\"Extended Petri Net\"/>\n  <nodeclasses count=\"2\">\n");
+  fprintf(out, "    <nodeclass count=\"%llu\" name=\"Place\">\n", P);
+  for (unsigned long long i = 0; i < P; ++i){
+    fprintf(out, "      <node id=\"%llu\" net=\"1\"><attribute name=\"Name\" net=\"1\"><![CDATA[p%llu]]></attribute><attribute name=\"ID\" net=\"1\"><![CDATA[%llu]]></attribute><attribute name=\"Marking\" net=\"1\"><![CDATA[%llu]]></attribute></node>\n", i + 1, i, i, placeTokens[i]);
+  }
+  fprintf(out, "    </nodeclass>\n    <nodeclass count=\"%u\" name=\"Transition\">\n", transitionCount);
+  for (unsigned long long i = 0; i < transitionCount; ++i){
+    fprintf(out, "      <node id=\"%llu\" net=\"1\"><attribute name=\"Name\" net=\"1\"><![CDATA[t%llu]]></attribute><attribute name=\"ID\" net=\"1\"><![CDATA[%llu]]></attribute></node>\n", P + i + 1, i, i);
+  }
+  fprintf(out, "    </nodeclass>\n  </nodeclasses>\n  <edgeclasses count=\"5\">\n");
+  for (unsigned int E = 0; E < 5; ++E){
+    fprintf(out, "    <edgeclass count=\"%u\" name=\"%s\">\n", (unsigned int)arcs[E].size(), edgeClassNames[E]);
+    std::vector<PetriGenArc>::iterator A;
+    for (A = arcs[E].begin(); A != arcs[E].end(); A++){
+      unsigned long long place = A->place + 1, trans = P + A->transition + 1;
+      fprintf(out, "      <edge source=\"%llu\" target=\"%llu\" id=\"%llu\" net=\"1\"><attribute name=\"Multiplicity\" net=\"1\"><![CDATA[%u]]></attribute></edge>\n", A->toPlace ? trans : place, A->toPlace ? place : trans, nextId++, A->multiplicity);
+    }
+    fprintf(out, "    </edgeclass>\n");
+  }
+  fprintf(out, "  </edgeclasses>\n</Snoopy>\n");
+}
@@ -0,0 +1,47 @@
+/// \file petrigen.h
+/// \brief Synthetic Snoopy net generator header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include "petricalc.h"
+
+/// \brief A single generated arc, stored compactly so nets with tens of millions of arcs fit in memory.
+struct PetriGenArc{
+  unsigned int place; ///< Index of the connected place.
+  unsigned int transition; ///< Index of the connected transition.
+  unsigned int multiplicity; ///< Multiplicity of the arc.
+  bool toPlace; ///< True if the arc goes from the transition to the place.
+};
+
+/// \brief Builds synthetic Petri nets in parameterised families and writes them in Snoopy format.
+///
+/// All places, transitions and arcs are collected first, since the Snoopy format requires them to be grouped by class.
+/// Writing is streamed, so the only memory used is that of the compact arc lists.
+class PetriGenerator{
+  public:
+    PetriGenerator(unsigned long long seed);
+    bool generate(std::string family, unsigned long long size);
+    void write(FILE * out);
+    static std::string families();
+    unsigned long long places();
+    unsigned long long transitionIdBase();
+    unsigned int transitions();
+    unsigned int addPlace(unsigned long long tokens);
+    unsigned int addTransition();
+    void addArc(unsigned int edgeType, unsigned int place, unsigned int transition, unsigned int multiplicity, bool toPlace);
+    unsigned long long tokens; ///< Base token count for families that allow it, 0 to use the family default.
+  private:
+    PetriRandom rng; ///< Random number generator used by the random families.
+    std::vector<unsigned long long> placeTokens; ///< Initial marking of each place.
+    unsigned int transitionCount; ///< Amount of transitions added so far.
+    std::vector<PetriGenArc> arcs[5]; ///< Arcs per Snoopy edge class, in the order of edgeClassNames.
+    void chain(unsigned long long size);
+    void forkJoin(unsigned long long size);
+    void grid(unsigned long long size);
+    void philosophers(unsigned long long size);
+    void scaleFree(unsigned long long size);
+    void kinetics(unsigned long long size);
+};
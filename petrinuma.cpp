@@ -0,0 +1,89 @@
+/// \file petrinuma.cpp
+/// \brief PetriCalc NUMA topology and thread placement implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+///
+/// The topology is read from sysfs and threads are placed with sched_setaffinity, so no NUMA library is needed.
+/// Memory follows the threads through the first-touch policy of the kernel: pages end up on the node of the thread writing them first.
+
+#include "petrinuma.h"
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/// \brief Parses a sysfs list such as "0-3,8,10-11" into the numbers it contains.
+static void parseList(const char * text, std::vector<unsigned int> & list){
+  const char * p = text;
+  while (*p >= '0' && *p <= '9'){
+    char * end;
+    unsigned int first = strtoul(p, &end, 10), last = first;
+    if (*end == '-'){last = strtoul(end + 1, &end, 10);}
+    for (unsigned int n = first; n <= last; ++n){list.push_back(n);}
+    p = (*end == ',') ? end + 1 : end;
+  }
+}
+
+/// \brief Reads a sysfs list file into the numbers it contains. Returns false if the file could not be read.
+static bool readList(const char * path, std::vector<unsigned int> & list){
+  FILE * F = fopen(path, "r");
+  if (!F){return false;}
+  char buf[4096];
+  bool ok = fgets(buf, sizeof(buf), F);
+  fclose(F);
+  if (ok){parseList(buf, list);}
+  return ok;
+}
+
+/// \brief Finds the CPUs the calling thread may run on. Returns false if they could not be read.
+bool threadCpus(std::vector<unsigned int> & cpus){
+  cpus.clear();
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set)){return false;}
+  for (unsigned int c = 0; c < CPU_SETSIZE; ++c){
+    if (CPU_ISSET(c, &set)){cpus.push_back(c);}
+  }
+#endif
+  return cpus.size() > 0;
+}
+
+/// \brief Finds the NUMA nodes of this machine, with per node the CPUs the calling thread may run on.
+///
+/// Nodes without such CPUs are left out. Returns false if the topology could not be read, leaving nodes empty.
+bool numaNodes(std::vector<std::vector<unsigned int> > & nodes){
+  nodes.clear();
+  std::vector<unsigned int> allowed, online;
+  if (!threadCpus(allowed) || !readList("/sys/devices/system/node/online", online)){return false;}
+  std::vector<bool> usable;
+  for (unsigned int i = 0; i < allowed.size(); ++i){
+    if (allowed[i] >= usable.size()){usable.resize(allowed[i] + 1, false);}
+    usable[allowed[i]] = true;
+  }
+  for (unsigned int i = 0; i < online.size(); ++i){
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", online[i]);
+    std::vector<unsigned int> cpus, mine;
+    readList(path, cpus);
+    for (unsigned int c = 0; c < cpus.size(); ++c){
+      if (cpus[c] < usable.size() && usable[cpus[c]]){mine.push_back(cpus[c]);}
+    }
+    if (mine.size()){nodes.push_back(mine);}
+  }
+  return nodes.size() > 0;
+}
+
+/// \brief Restricts the calling thread to the given CPUs. Returns false if the thread could not be placed.
+bool pinThread(const std::vector<unsigned int> & cpus){
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned int i = 0; i < cpus.size(); ++i){
+    if (cpus[i] < CPU_SETSIZE){CPU_SET(cpus[i], &set);}
+  }
+  return !sched_setaffinity(0, sizeof(set), &set);
+#else
+  return false;
+#endif
+}
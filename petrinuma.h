@@ -0,0 +1,10 @@
+/// \file petrinuma.h
+/// \brief PetriCalc NUMA topology and thread placement header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <vector>
+
+bool numaNodes(std::vector<std::vector<unsigned int> > & nodes);
+bool threadCpus(std::vector<unsigned int> & cpus);
+bool pinThread(const std::vector<unsigned int> & cpus);
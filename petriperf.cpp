@@ -0,0 +1,153 @@
+/// \file petriperf.cpp
+/// \brief PetriCalc hardware performance counter implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petriperf.h"
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+/// \brief Names of the phases, as used in reports.
+static const char * perfPhaseNames[PERF_PHASES] = {"scan", "select", "fire", "output", "load", "compile"};
+
+/// \brief Names of the counters, as used in reports.
+static const char * perfCounterNames[PERF_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+
+/// \brief Creates a collector without any counters opened.
+PetriPerf::PetriPerf(){
+  for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+    fds[C] = -1;
+    slot[C] = 0;
+    last[C] = 0;
+  }
+  opened = 0;
+  multiplexed = false;
+  memset(totals, 0, sizeof(totals));
+  memset(calls, 0, sizeof(calls));
+}
+
+/// \brief Closes all opened counters.
+PetriPerf::~PetriPerf(){
+  for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+    if (fds[C] != -1){close(fds[C]);}
+  }
+}
+
+/// \brief Opens and starts the counters on the calling thread.
+///
+/// Returns true if at least one counter could be opened.
+bool PetriPerf::open(){
+#if defined(__linux__)
+  unsigned long long configs[PERF_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  int leader = -1;
+  for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[C];
+    attr.disabled = (leader == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds[C] = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fds[C] == -1){continue;}
+    if (leader == -1){leader = fds[C];}
+    slot[C] = opened++;
+  }
+  if (leader == -1){return false;}
+  ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  read(last);
+  return true;
+#else
+  return false;
+#endif
+}
+
+/// \brief Returns true if at least one counter is open.
+bool PetriPerf::available(){
+  return opened > 0;
+}
+
+/// \brief Reads all counters of the group at once into values, indexed by counter.
+bool PetriPerf::read(unsigned long long * values){
+  //Layout of a group read: amount of counters, time enabled, time running, then one value per counter
+  unsigned long long buffer[3 + PERF_COUNTERS];
+  int leader = -1;
+  for (unsigned int C = 0; C < PERF_COUNTERS && leader == -1; ++C){leader = fds[C];}
+  if (leader == -1){return false;}
+  if (::read(leader, buffer, sizeof(buffer)) < (ssize_t)((3 + opened) * sizeof(unsigned long long))){return false;}
+  if (buffer[2] < buffer[1]){multiplexed = true;}
+  for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+    values[C] = (fds[C] == -1) ? 0 : buffer[3 + slot[C]];
+  }
+  return true;
+}
+
+/// \brief Starts a new measurement: counts from now on are attributed to the next phase call.
+void PetriPerf::mark(){
+  if (opened){read(last);}
+}
+
+/// \brief Attributes all counts since the last mark or phase call to the given phase.
+void PetriPerf::phase(unsigned int P){
+  unsigned long long now[PERF_COUNTERS];
+  if (!opened || !read(now)){return;}
+  for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+    totals[P][C] += now[C] - last[C];
+    last[C] = now[C];
+  }
+  calls[P]++;
+}
+
+/// \brief Writes the per-phase totals as a JSON object, without trailing newline.
+///
+/// Counters that could not be opened are written as null.
+void PetriPerf::writeJSON(FILE * out){
+  fprintf(out, "{\"multiplexed\":%s", multiplexed ? "true" : "false");
+  for (unsigned int P = 0; P < PERF_PHASES; ++P){
+    fprintf(out, ",\"%s\":{", perfPhaseNames[P]);
+    for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+      if (fds[C] == -1){
+        fprintf(out, "%s\"%s\":null", C ? "," : "", perfCounterNames[C]);
+      }else{
+        fprintf(out, "%s\"%s\":%llu", C ? "," : "", perfCounterNames[C], totals[P][C]);
+      }
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "}");
+}
+
+/// \brief Prints a human readable table of the counters.
+///
+/// Stepping phases are printed as averages per step, load and compile as totals.
+void PetriPerf::report(FILE * out, unsigned long long steps, double stepsPerSecond){
+  fprintf(out, "Hardware counters (user space%s), %.1f steps/s:\n", multiplexed ? ", multiplexed" : "", stepsPerSecond);
+  fprintf(out, "  %-8s %14s %14s %6s %14s %14s\n", "phase", "cycles", "instructions", "IPC", "cache misses", "branch misses");
+  for (unsigned int P = 0; P < PERF_PHASES; ++P){
+    if (!calls[P]){continue;}
+    double div = (P < PHASE_COUNT && steps) ? steps : 1;
+    fprintf(out, "  %-8s", perfPhaseNames[P]);
+    for (unsigned int C = 0; C < PERF_COUNTERS; ++C){
+      if (fds[C] == -1){
+        fprintf(out, " %14s", "n/a");
+      }else{
+        fprintf(out, " %14.1f", totals[P][C] / div);
+      }
+      if (C == PERF_INSTRUCTIONS){
+        if (fds[PERF_CYCLES] != -1 && fds[PERF_INSTRUCTIONS] != -1 && totals[P][PERF_CYCLES]){
+          fprintf(out, " %6.2f", totals[P][PERF_INSTRUCTIONS] / (double)totals[P][PERF_CYCLES]);
+        }else{
+          fprintf(out, " %6s", "n/a");
+        }
+      }
+    }
+    fprintf(out, "%s\n", (P < PHASE_COUNT) ? " /step" : " total");
+  }
+}
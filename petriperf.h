@@ -0,0 +1,44 @@
+/// \file petriperf.h
+/// \brief PetriCalc hardware performance counter header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include "petristats.h"
+#include <stdio.h>
+
+//Stepping phases use the PHASE_* numbers from petristats.h, load and compile are added after those.
+#define PERF_PHASE_LOAD PHASE_COUNT ///< Reading the net file
+#define PERF_PHASE_COMPILE (PHASE_COUNT + 1) ///< Preparing the net for an engine
+#define PERF_PHASES (PHASE_COUNT + 2) ///< Amount of phases
+
+#define PERF_CYCLES 0 ///< CPU cycles
+#define PERF_INSTRUCTIONS 1 ///< Retired instructions
+#define PERF_CACHE_MISSES 2 ///< Last level cache misses
+#define PERF_BRANCH_MISSES 3 ///< Mispredicted branches
+#define PERF_COUNTERS 4 ///< Amount of counters
+
+/// \brief Hardware performance counters per phase, through the Linux perf_event_open interface.
+///
+/// All counters are opened as a single group on the calling thread, counting user space only, and read at every phase boundary.
+/// Each read is a system call, so this costs a few microseconds per phase and is meant for tuning runs only.
+/// Counters the kernel or CPU does not support are left out, and the whole collector is unavailable when none can be opened.
+class PetriPerf{
+  public:
+    PetriPerf();
+    ~PetriPerf();
+    bool open();
+    bool available();
+    void mark();
+    void phase(unsigned int P);
+    void writeJSON(FILE * out);
+    void report(FILE * out, unsigned long long steps, double stepsPerSecond);
+  private:
+    bool read(unsigned long long * values);
+    int fds[PERF_COUNTERS]; ///< File descriptors of the counters, -1 if not opened.
+    unsigned int slot[PERF_COUNTERS]; ///< Position of each counter in a group read.
+    unsigned int opened; ///< Amount of opened counters.
+    unsigned long long last[PERF_COUNTERS]; ///< Counter values at the last phase boundary.
+    unsigned long long totals[PERF_PHASES][PERF_COUNTERS]; ///< Counter totals per phase.
+    unsigned long long calls[PERF_PHASES]; ///< Amount of times each phase was measured.
+    bool multiplexed; ///< True if the kernel ever had to share the counters with other users.
+};
@@ -0,0 +1,87 @@
+/// \file petripool.cpp
+/// \brief PetriCalc thread pool implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petripool.h"
+#include "petritimeline.h"
+
+/// \brief Starts threads - 1 worker threads.
+PetriPool::PetriPool(unsigned int threads) : generation(0), sleepers(0), nextJob(0), jobCount(0), doneJobs(0), stopping(false){
+  jobFunction = 0;
+  jobArg = 0;
+  for (unsigned int i = 1; i < threads; ++i){workers.push_back(std::thread(&PetriPool::work, this));}
+}
+
+/// \brief Stops and joins all worker threads.
+PetriPool::~PetriPool(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (unsigned int i = 0; i < workers.size(); ++i){workers[i].join();}
+}
+
+/// \brief Returns the amount of threads working on jobs, including the caller of run.
+unsigned int PetriPool::size(){
+  return workers.size() + 1;
+}
+
+/// \brief Claims and runs jobs of run gen until none are left, or until a later run has started.
+///
+/// A job is only claimed while nextJob still holds gen, so a thread that is late for a run can never claim, and run twice,
+/// an index of the next run. As a run only ends after all its jobs are claimed and done, the job function and argument
+/// read after a claim are always those of run gen.
+void PetriPool::claim(unsigned int gen){
+  unsigned long long next = nextJob.load(std::memory_order_acquire);
+  while (true){
+    unsigned long long count = jobCount.load(std::memory_order_relaxed);
+    if ((next >> 32) != gen || (count >> 32) != gen || (next & 0xFFFFFFFFull) >= (count & 0xFFFFFFFFull)){return;}
+    //On failure, next is reloaded and checked again
+    if (!nextJob.compare_exchange_weak(next, next + 1, std::memory_order_acq_rel, std::memory_order_acquire)){continue;}
+    jobFunction(jobArg, next & 0xFFFFFFFFull);
+    doneJobs.fetch_add(1, std::memory_order_release);
+    next = nextJob.load(std::memory_order_acquire);
+  }
+}
+
+/// \brief Calls job(arg, i) for every i from 0 up to but not including jobs, spread over all threads, and returns when all calls are done.
+///
+/// Jobs are claimed one at a time, so threads that finish early take over the remaining jobs.
+void PetriPool::run(unsigned int jobs, void (*job)(void * arg, unsigned int index), void * arg){
+  unsigned int gen = generation.load(std::memory_order_relaxed) + 1;
+  //Every job of the previous run is done, so no thread reads these until it claims a job of this run
+  jobFunction = job;
+  jobArg = arg;
+  doneJobs.store(0, std::memory_order_relaxed);
+  jobCount.store(((unsigned long long)gen << 32) | jobs, std::memory_order_relaxed);
+  //Release, so threads that see this run in nextJob also see its job count, function and argument
+  nextJob.store((unsigned long long)gen << 32, std::memory_order_release);
+  //Sequentially consistent with the sleepers counter, so either a worker sees the new generation or we see it sleeping
+  generation++;
+  if (sleepers){
+    std::lock_guard<std::mutex> lock(mutex);
+    wake.notify_all();
+  }
+  claim(gen);
+  while (doneJobs.load(std::memory_order_acquire) < jobs){std::this_thread::yield();}
+}
+
+/// \brief Worker thread main loop: waits for a new run, then helps with its jobs.
+void PetriPool::work(){
+  timelineThreadName("pool");
+  unsigned long long seen = generation.load(std::memory_order_acquire);
+  while (true){
+    unsigned int spin = 0;
+    while (generation.load(std::memory_order_acquire) == seen && !stopping && spin++ < POOL_SPIN){std::this_thread::yield();}
+    if (generation.load(std::memory_order_acquire) == seen && !stopping){
+      std::unique_lock<std::mutex> lock(mutex);
+      sleepers++;
+      while (generation.load(std::memory_order_acquire) == seen && !stopping){wake.wait(lock);}
+      sleepers--;
+    }
+    if (stopping){return;}
+    seen = generation.load(std::memory_order_acquire);
+    claim(seen);
+  }
+}
@@ -0,0 +1,40 @@
+/// \file petripool.h
+/// \brief PetriCalc thread pool header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Times a waiting thread checks for new work, yielding the CPU in between, before going to sleep.
+#define POOL_SPIN 2000
+
+/// \brief A persistent pool of worker threads running numbered jobs, for work that is handed out every step.
+///
+/// Threads are started once and wait for work between calls, spinning briefly before sleeping,
+/// so handing out work costs a few atomic operations instead of creating threads.
+/// The calling thread works on jobs too, so a pool of n threads starts n - 1 workers.
+class PetriPool{
+  public:
+    PetriPool(unsigned int threads);
+    ~PetriPool();
+    void run(unsigned int jobs, void (*job)(void * arg, unsigned int index), void * arg);
+    unsigned int size();
+  private:
+    void work();
+    void claim(unsigned int gen);
+    std::vector<std::thread> workers; ///< Worker threads, excluding the caller of run.
+    std::mutex mutex; ///< Guards sleeping and waking.
+    std::condition_variable wake; ///< Signalled when new work arrives or the pool stops.
+    std::atomic<unsigned long long> generation; ///< Increased for every call to run.
+    std::atomic<unsigned int> sleepers; ///< Workers waiting on wake.
+    std::atomic<unsigned long long> nextJob; ///< Generation of the current run in the upper 32 bits, next job index to be claimed in the lower 32 bits.
+    std::atomic<unsigned long long> jobCount; ///< Generation of the current run in the upper 32 bits, jobs in the run in the lower 32 bits.
+    std::atomic<unsigned int> doneJobs; ///< Jobs finished in the current run.
+    std::atomic<bool> stopping; ///< Set when the pool is destroyed.
+    void (*jobFunction)(void *, unsigned int); ///< Job function of the current run, published by the release store of nextJob and only read after claiming a job.
+    void * jobArg; ///< Argument of the current run, published like jobFunction.
+};
@@ -0,0 +1,16 @@
+/// \file petrirandom.h
+/// \brief PetriCalc random number generator header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+
+/// \brief A small, fast pseudo-random number generator (xoshiro256**).
+/// Unlike rand(), its complete state is accessible so that it can be stored in and restored from checkpoints.
+class PetriRandom{
+  public:
+    PetriRandom();
+    void seed(unsigned long long s);
+    unsigned long long next();
+    unsigned long long below(unsigned long long n);
+    unsigned long long state[4]; ///< The complete generator state.
+};
@@ -0,0 +1,176 @@
+/// \file petrisimd.cpp
+/// \brief PetriCalc SIMD range function kernels.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+///
+/// Every kernel computes, for count arcs, bit i of bits as tokens[place[i]] - low[i] <= span[i], the range function of PetriCompiled.
+/// Low and span are the 32-bit forms of PetriCompiled, with a span of ARC_SPAN_OPEN meaning INFTY - low.
+/// Results for ARC_SPAN_WIDE arcs are meaningless, the caller corrects those.
+/// The lane kernels instead evaluate and fire arcs for the ENSEMBLE_LANES interleaved markings of a lockstep ensemble,
+/// with full 64-bit low and span values.
+/// The kernels are compiled for their instruction set through target attributes, so the rest of the program runs on any CPU.
+/// Only call a kernel after detectIsa has confirmed the CPU supports it.
+
+#include "petriengine.h"
+#include "petriensemble.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/// \brief Evaluates arcs start up to but not including end one at a time, into a single word of bits.
+static inline unsigned long long rangeBitsScalar(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned int start, unsigned int end){
+  unsigned long long word = 0;
+  for (unsigned int i = start; i < end; ++i){
+    unsigned long long l = low[i], s = (span[i] == ARC_SPAN_OPEN) ? ~l : span[i];
+    word |= (unsigned long long)(tokens[place[i]] - l <= s) << (i & 63);
+  }
+  return word;
+}
+
+/// \brief Finds the lanes in which each transition is enabled, out of the lanes in active, one lane at a time.
+void laneScanScalar(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks){
+  for (unsigned int t = 0; t < transitions; ++t){
+    unsigned int pass = active;
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1] && pass; ++a){
+      const unsigned long long * m = tokens + (unsigned long long)place[a] * ENSEMBLE_LANES;
+      for (unsigned int l = 0; l < ENSEMBLE_LANES; ++l){
+        if (m[l] - low[a] > span[a]){pass &= ~(1u << l);}
+      }
+    }
+    masks[t] = pass;
+  }
+}
+
+/// \brief Applies the effects of arcs start up to but not including end, in the given lanes only.
+void laneFireScalar(const unsigned int * place, const long long * effect, const unsigned char * setter, unsigned long long * tokens, unsigned int start, unsigned int end, unsigned int lanes){
+  for (unsigned int a = start; a < end; ++a){
+    unsigned long long * m = tokens + (unsigned long long)place[a] * ENSEMBLE_LANES;
+    for (unsigned int left = lanes; left; left &= left - 1){
+      unsigned int l = __builtin_ctz(left);
+      if (setter[a]){
+        m[l] = effect[a];
+      }else{
+        m[l] += effect[a];
+      }
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/// \brief AVX2 lane scan, 4 lanes per instruction, offsetting both sides by the sign bit for unsigned compares.
+__attribute__((target("avx2"))) void laneScanAvx2(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks){
+  const __m256i sign = _mm256_set1_epi64x(0x8000000000000000ll);
+  for (unsigned int t = 0; t < transitions; ++t){
+    unsigned int pass = active;
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1] && pass; ++a){
+      const unsigned long long * m = tokens + (unsigned long long)place[a] * ENSEMBLE_LANES;
+      __m256i l = _mm256_set1_epi64x(low[a]);
+      __m256i s = _mm256_xor_si256(_mm256_set1_epi64x(span[a]), sign);
+      __m256i d0 = _mm256_xor_si256(_mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)m), l), sign);
+      __m256i d1 = _mm256_xor_si256(_mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(m + 4)), l), sign);
+      unsigned int fail = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(d0, s)));
+      fail |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(d1, s))) << 4;
+      pass &= ~fail;
+    }
+    masks[t] = pass;
+  }
+}
+
+/// \brief AVX-512 lane scan, all lanes in a single unsigned compare into a mask register.
+__attribute__((target("avx512f"))) void laneScanAvx512(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks){
+  for (unsigned int t = 0; t < transitions; ++t){
+    __mmask8 pass = active;
+    for (unsigned int a = arcStart[t]; a < arcStart[t + 1] && pass; ++a){
+      __m512i m = _mm512_loadu_si512((const void *)(tokens + (unsigned long long)place[a] * ENSEMBLE_LANES));
+      pass = _mm512_mask_cmp_epu64_mask(pass, _mm512_sub_epi64(m, _mm512_set1_epi64(low[a])), _mm512_set1_epi64(span[a]), _MM_CMPINT_LE);
+    }
+    masks[t] = pass;
+  }
+}
+
+/// \brief AVX-512 lane fire, a masked add or move per arc. AVX2 lacks mask registers, so it uses the scalar version.
+__attribute__((target("avx512f"))) void laneFireAvx512(const unsigned int * place, const long long * effect, const unsigned char * setter, unsigned long long * tokens, unsigned int start, unsigned int end, unsigned int lanes){
+  for (unsigned int a = start; a < end; ++a){
+    unsigned long long * p = tokens + (unsigned long long)place[a] * ENSEMBLE_LANES;
+    __m512i m = _mm512_loadu_si512((const void *)p);
+    __m512i e = _mm512_set1_epi64(effect[a]);
+    m = setter[a] ? _mm512_mask_mov_epi64(m, lanes, e) : _mm512_mask_add_epi64(m, lanes, m, e);
+    _mm512_storeu_si512((void *)p, m);
+  }
+}
+
+/// \brief AVX2 kernel, 4 arcs per instruction. AVX2 lacks unsigned 64-bit compares, so both sides are offset by the sign bit.
+__attribute__((target("avx2"))) void rangeBitsAvx2(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned long long * bits, unsigned int count){
+  const __m256i sign = _mm256_set1_epi64x(0x8000000000000000ll);
+  const __m256i open = _mm256_set1_epi64x(ARC_SPAN_OPEN);
+  unsigned int full = count & ~63u;
+  for (unsigned int w = 0; w < full; w += 64){
+    unsigned long long word = 0;
+    for (unsigned int i = w; i < w + 64; i += 4){
+      __m128i idx = _mm_loadu_si128((const __m128i *)(place + i));
+      __m256i m = _mm256_i32gather_epi64((const long long *)tokens, idx, 8);
+      __m256i l = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(low + i)));
+      __m256i s = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(span + i)));
+      //Open spans become ~low, which is low xor all ones
+      s = _mm256_blendv_epi8(s, _mm256_xor_si256(l, _mm256_cmpeq_epi64(l, l)), _mm256_cmpeq_epi64(s, open));
+      __m256i d = _mm256_sub_epi64(m, l);
+      __m256i fail = _mm256_cmpgt_epi64(_mm256_xor_si256(d, sign), _mm256_xor_si256(s, sign));
+      word |= (unsigned long long)(~_mm256_movemask_pd(_mm256_castsi256_pd(fail)) & 0xF) << (i & 63);
+    }
+    bits[w >> 6] = word;
+  }
+  if (full < count){bits[full >> 6] = rangeBitsScalar(place, low, span, tokens, full, count);}
+}
+
+/// \brief AVX-512 kernel, 8 arcs per instruction, using native unsigned compares into mask registers.
+///
+/// Gathers and widening moves start from zero rather than the undefined vector of the unmasked intrinsics, which optimized GCC builds warn about.
+__attribute__((target("avx512f"))) void rangeBitsAvx512(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned long long * bits, unsigned int count){
+  const __m512i open = _mm512_set1_epi64(ARC_SPAN_OPEN);
+  const __m512i zero = _mm512_setzero_si512();
+  unsigned int full = count & ~63u;
+  for (unsigned int w = 0; w < full; w += 64){
+    unsigned long long word = 0;
+    for (unsigned int i = w; i < w + 64; i += 8){
+      __m256i idx = _mm256_loadu_si256((const __m256i *)(place + i));
+      __m512i m = _mm512_mask_i32gather_epi64(zero, 0xFF, idx, (const void *)tokens, 8);
+      __m512i l = _mm512_maskz_cvtepu32_epi64(0xFF, _mm256_loadu_si256((const __m256i *)(low + i)));
+      __m512i s = _mm512_maskz_cvtepu32_epi64(0xFF, _mm256_loadu_si256((const __m256i *)(span + i)));
+      //Open spans become ~low
+      s = _mm512_mask_ternarylogic_epi64(s, _mm512_cmpeq_epu64_mask(s, open), l, l, 0x55);
+      __mmask8 pass = _mm512_cmp_epu64_mask(_mm512_sub_epi64(m, l), s, _MM_CMPINT_LE);
+      word |= (unsigned long long)pass << (i & 63);
+    }
+    bits[w >> 6] = word;
+  }
+  if (full < count){bits[full >> 6] = rangeBitsScalar(place, low, span, tokens, full, count);}
+}
+
+#else
+
+/// \brief Portable stand-in, never selected by detectIsa on this architecture.
+void rangeBitsAvx2(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned long long * bits, unsigned int count){
+  for (unsigned int w = 0; w < count; w += 64){bits[w >> 6] = rangeBitsScalar(place, low, span, tokens, w, (w + 64 < count) ? w + 64 : count);}
+}
+
+/// \brief Portable stand-in, never selected by detectIsa on this architecture.
+void rangeBitsAvx512(const unsigned int * place, const unsigned int * low, const unsigned int * span, const unsigned long long * tokens, unsigned long long * bits, unsigned int count){
+  rangeBitsAvx2(place, low, span, tokens, bits, count);
+}
+
+/// \brief Portable stand-in, never selected by detectIsa on this architecture.
+void laneScanAvx2(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks){
+  laneScanScalar(arcStart, place, low, span, tokens, active, transitions, masks);
+}
+
+/// \brief Portable stand-in, never selected by detectIsa on this architecture.
+void laneScanAvx512(const unsigned int * arcStart, const unsigned int * place, const unsigned long long * low, const unsigned long long * span, const unsigned long long * tokens, unsigned int active, unsigned int transitions, unsigned char * masks){
+  laneScanScalar(arcStart, place, low, span, tokens, active, transitions, masks);
+}
+
+/// \brief Portable stand-in, never selected by detectIsa on this architecture.
+void laneFireAvx512(const unsigned int * place, const long long * effect, const unsigned char * setter, unsigned long long * tokens, unsigned int start, unsigned int end, unsigned int lanes){
+  laneFireScalar(place, effect, setter, tokens, start, end, lanes);
+}
+
+#endif
@@ -0,0 +1,146 @@
+/// \file petristats.cpp
+/// \brief PetriCalc runtime statistics implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#include "petristats.h"
+#include "petriperf.h"
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+
+/// Amount of calls to the global operator new, over all threads.
+static unsigned long long allocationCount = 0;
+
+/// \brief Replacement of the global operator new that counts allocations.
+void * operator new(size_t size){
+  __atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+  void * ptr = malloc(size ? size : 1);
+  if (!ptr){throw std::bad_alloc();}
+  return ptr;
+}
+
+/// \brief Replacement of the global operator delete, matching the operator new replacement.
+void operator delete(void * ptr) noexcept{
+  free(ptr);
+}
+
+/// \brief Replacement of the global sized operator delete, matching the operator new replacement.
+void operator delete(void * ptr, size_t) noexcept{
+  free(ptr);
+}
+
+/// \brief Names of the phases, as used in reports.
+static const char * phaseNames[PHASE_COUNT] = {"scan", "select", "fire", "output"};
+
+/// \brief Creates a statistics object with all counters at zero.
+PetriStats::PetriStats(){
+  steps = 0;
+  enabledChecks = 0;
+  arcsEvaluated = 0;
+  memset(enabledHistogram, 0, sizeof(enabledHistogram));
+  memset(superHistogram, 0, sizeof(superHistogram));
+  memset(phaseTicks, 0, sizeof(phaseTicks));
+  perf = 0;
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  startTicks = ticks();
+}
+
+/// \brief Starts a hardware counter measurement. Kept out of line, so the inline begin stays small.
+void PetriStats::perfMark(){
+  perf->mark();
+}
+
+/// \brief Ends a hardware counter measurement for the given phase. Kept out of line, so the inline phase stays small.
+void PetriStats::perfPhase(unsigned int P){
+  perf->phase(P);
+}
+
+/// \brief Returns the total amount of heap allocations made by the process so far.
+unsigned long long PetriStats::allocations(){
+  return __atomic_load_n(&allocationCount, __ATOMIC_RELAXED);
+}
+
+/// \brief Adds the counters of other to these, such as those of another thread. Phase ticks add up over threads.
+void PetriStats::add(const PetriStats & other){
+  steps += other.steps;
+  enabledChecks += other.enabledChecks;
+  arcsEvaluated += other.arcsEvaluated;
+  for (unsigned int b = 0; b < STATS_BUCKETS; ++b){
+    enabledHistogram[b] += other.enabledHistogram[b];
+    superHistogram[b] += other.superHistogram[b];
+  }
+  for (unsigned int P = 0; P < PHASE_COUNT; ++P){phaseTicks[P] += other.phaseTicks[P];}
+}
+
+/// \brief Returns the amount of ticks per second, measured since construction.
+double PetriStats::ticksPerSecond(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+  if (elapsed <= 0){return 1e9;}
+  return (ticks() - startTicks) / elapsed;
+}
+
+/// \brief Writes all counters as a single line of JSON.
+///
+/// Histograms are written as arrays indexed by bucket, with trailing empty buckets left out.
+void PetriStats::writeJSON(FILE * out, bool final){
+  double tps = ticksPerSecond();
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+  fprintf(out, "{\"final\":%s,\"elapsed_s\":%.6f,\"steps\":%llu,\"enabled_checks\":%llu,\"arcs_evaluated\":%llu,\"allocations\":%llu", final ? "true" : "false", elapsed, steps, enabledChecks, arcsEvaluated, allocations());
+  fprintf(out, ",\"phase_s\":{");
+  for (unsigned int P = 0; P < PHASE_COUNT; ++P){
+    fprintf(out, "%s\"%s\":%.6f", P ? "," : "", phaseNames[P], phaseTicks[P] / tps);
+  }
+  fprintf(out, "}");
+  unsigned long long * histograms[2] = {enabledHistogram, superHistogram};
+  const char * histogramNames[2] = {"enabled_hist", "super_hist"};
+  for (unsigned int h = 0; h < 2; ++h){
+    unsigned int last = 0;
+    for (unsigned int b = 0; b < STATS_BUCKETS; ++b){
+      if (histograms[h][b]){last = b + 1;}
+    }
+    fprintf(out, ",\"%s\":[", histogramNames[h]);
+    for (unsigned int b = 0; b < last; ++b){
+      fprintf(out, "%s%llu", b ? "," : "", histograms[h][b]);
+    }
+    fprintf(out, "]");
+  }
+  if (perf){
+    fprintf(out, ",\"perf\":");
+    perf->writeJSON(out);
+  }
+  fprintf(out, "}\n");
+  fflush(out);
+}
+
+/// \brief Prints a human readable summary of all counters.
+void PetriStats::report(FILE * out){
+  double tps = ticksPerSecond();
+  double total = 0;
+  for (unsigned int P = 0; P < PHASE_COUNT; ++P){total += phaseTicks[P] / tps;}
+  fprintf(out, "Steps: %llu, enabledness checks: %llu (%.1f/step), arcs evaluated: %llu (%.1f/step), allocations: %llu\n", steps, enabledChecks, steps ? enabledChecks / (double)steps : 0.0, arcsEvaluated, steps ? arcsEvaluated / (double)steps : 0.0, allocations());
+  for (unsigned int P = 0; P < PHASE_COUNT; ++P){
+    double t = phaseTicks[P] / tps;
+    fprintf(out, "  %-7s %10.3fs (%5.1f%%)\n", phaseNames[P], t, total ? t / total * 100 : 0.0);
+  }
+  unsigned long long * histograms[2] = {enabledHistogram, superHistogram};
+  const char * histogramNames[2] = {"Enabled transitions per step", "Transitions fired per step"};
+  for (unsigned int h = 0; h < 2; ++h){
+    fprintf(out, "%s:\n", histogramNames[h]);
+    for (unsigned int b = 0; b < STATS_BUCKETS; ++b){
+      if (!histograms[h][b]){continue;}
+      unsigned long long low = b ? (1ull << (b - 1)) : 0;
+      unsigned long long high = b ? ((1ull << (b - 1)) * 2 - 1) : 0;
+      fprintf(out, "  %llu-%llu: %llu\n", low, high, histograms[h][b]);
+    }
+  }
+  if (perf){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+    perf->report(out, steps, elapsed > 0 ? steps / elapsed : 0.0);
+  }
+}
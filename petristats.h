@@ -0,0 +1,74 @@
+/// \file petristats.h
+/// \brief PetriCalc runtime statistics header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define STATS_BUCKETS 33 ///< Histogram buckets: 0, 1, 2-3, 4-7, ..., 2^31 and up
+
+#define PHASE_SCAN 0 ///< Checking all transitions for enabledness
+#define PHASE_SELECT 1 ///< Randomly choosing the transition(s) to fire
+#define PHASE_FIRE 2 ///< Applying the effect functions
+#define PHASE_OUTPUT 3 ///< Printing states
+#define PHASE_COUNT 4 ///< Amount of phases
+
+class PetriPerf;
+
+/// \brief Runtime counters, always collected while stepping.
+///
+/// Counters are plain increments and timings use the CPU timestamp counter, so collecting them costs a few nanoseconds per step.
+/// Ticks are converted to seconds when reporting, by comparing against the wall clock since construction.
+class PetriStats{
+  public:
+    PetriStats();
+    /// \brief Returns a cheap, monotonic timestamp in ticks.
+    static inline unsigned long long ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+    }
+    /// \brief Returns the histogram bucket for the given value.
+    static inline unsigned int bucket(unsigned long long v){
+      if (!v){return 0;}
+      unsigned int b = 64 - __builtin_clzll(v);
+      return (b < STATS_BUCKETS) ? b : STATS_BUCKETS - 1;
+    }
+    /// \brief Returns the current timestamp, to be passed to the first phase call of a step.
+    inline unsigned long long begin(){
+      if (perf){perfMark();}
+      return ticks();
+    }
+    /// \brief Adds the ticks since the given timestamp to the given phase, returning the current timestamp.
+    inline unsigned long long phase(unsigned int P, unsigned long long since){
+      unsigned long long t = ticks();
+      phaseTicks[P] += t - since;
+      if (perf){perfPhase(P);}
+      return t;
+    }
+    void writeJSON(FILE * out, bool final);
+    void report(FILE * out);
+    void add(const PetriStats & other);
+    static unsigned long long allocations();
+    unsigned long long steps; ///< Completed steps.
+    unsigned long long enabledChecks; ///< Enabledness checks of single transitions or combinations.
+    unsigned long long arcsEvaluated; ///< Range function evaluations.
+    unsigned long long enabledHistogram[STATS_BUCKETS]; ///< Sizes of the enabled set at the start of each step.
+    unsigned long long superHistogram[STATS_BUCKETS]; ///< Amount of transitions fired together per step.
+    unsigned long long phaseTicks[PHASE_COUNT]; ///< Ticks spent per phase.
+    PetriPerf * perf; ///< Optional hardware counters, updated at the same phase boundaries. Null when not used.
+  private:
+    void perfMark();
+    void perfPhase(unsigned int P);
+    double ticksPerSecond();
+    unsigned long long startTicks; ///< Timestamp at construction.
+    struct timespec startTime; ///< Wall clock time at construction.
+};
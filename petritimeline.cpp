@@ -0,0 +1,131 @@
+/// \file petritimeline.cpp
+/// \brief PetriCalc phase timeline implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+///
+/// Spans are stored in a buffer per thread without any locking, and written as Chrome trace event JSON by timelineWrite.
+/// The output can be opened in chrome://tracing or ui.perfetto.dev.
+
+#include "petritimeline.h"
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+volatile bool petriTimelineOn = false;
+
+/// Maximum amount of spans kept per thread. Later spans are counted, but dropped.
+#define TIMELINE_MAX_SPANS (1 << 20)
+
+/// \brief A single recorded span.
+struct TimelineEntry{
+  const char * name; ///< Name of the span.
+  const char * argName; ///< Name of the numeric argument, or null.
+  unsigned long long start; ///< Start time in nanoseconds.
+  unsigned long long end; ///< End time in nanoseconds.
+  unsigned long long arg; ///< Value of the numeric argument.
+};
+
+/// \brief All spans of a single thread.
+struct TimelineBuffer{
+  unsigned int tid; ///< Sequential thread number, as shown in the viewer.
+  std::string name; ///< Thread name, as shown in the viewer.
+  std::vector<TimelineEntry> spans; ///< Recorded spans, in order of ending.
+  unsigned long long dropped; ///< Spans not recorded because the buffer was full.
+};
+
+static std::mutex buffersMutex; ///< Guards buffers.
+static std::vector<TimelineBuffer *> buffers; ///< Buffers of all threads that ever recorded a span. They are kept until the process exits.
+static thread_local TimelineBuffer * myBuffer = 0; ///< Buffer of the current thread.
+static std::string outputName; ///< File the timeline is written to.
+static unsigned long long startTime = 0; ///< Time when the timeline was configured, all timestamps are relative to this.
+
+/// \brief Returns the buffer of the current thread, creating it if needed.
+static TimelineBuffer * threadBuffer(){
+  if (!myBuffer){
+    myBuffer = new TimelineBuffer;
+    myBuffer->dropped = 0;
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    myBuffer->tid = buffers.size() + 1;
+    myBuffer->name = (myBuffer->tid == 1) ? "main" : "thread";
+    buffers.push_back(myBuffer);
+  }
+  return myBuffer;
+}
+
+/// \brief Writes the timeline at process exit.
+static void timelineAtExit(){
+  timelineWrite();
+}
+
+/// \brief Starts recording spans, to be written to the given file at exit.
+///
+/// The calling thread is named "main". Returns false if the file cannot be created.
+bool timelineConfigure(std::string filename){
+  FILE * test = fopen(filename.c_str(), "w");
+  if (!test){return false;}
+  fclose(test);
+  outputName = filename;
+  startTime = timelineNow();
+  threadBuffer();
+  atexit(timelineAtExit);
+  petriTimelineOn = true;
+  return true;
+}
+
+/// \brief Returns the current time of a steady clock, in nanoseconds. Never returns 0.
+unsigned long long timelineNow(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec + 1;
+}
+
+/// \brief Records a span on the timeline of the current thread, with an optional numeric argument.
+///
+/// Call only when TIMELINE_ON is true. The names must be string literals or otherwise live until timelineWrite is called.
+void timelineSpan(const char * name, unsigned long long start, unsigned long long end, const char * argName, unsigned long long arg){
+  TimelineBuffer * B = threadBuffer();
+  if (B->spans.size() >= TIMELINE_MAX_SPANS){
+    B->dropped++;
+    return;
+  }
+  TimelineEntry E = {name, argName, start, end, arg};
+  B->spans.push_back(E);
+}
+
+/// \brief Sets the name of the current thread, as shown in the viewer.
+void timelineThreadName(std::string name){
+  if (!TIMELINE_ON){return;}
+  threadBuffer()->name = name;
+}
+
+/// \brief Writes all recorded spans as Chrome trace event JSON and stops recording.
+///
+/// Must only be called when no other thread is recording spans anymore. Returns false if nothing was written.
+bool timelineWrite(){
+  if (!petriTimelineOn){return false;}
+  petriTimelineOn = false;
+  FILE * out = fopen(outputName.c_str(), "w");
+  if (!out){
+    fprintf(stderr, "Could not write timeline to %s\n", outputName.c_str());
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  unsigned int pid = getpid();
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":\"PetriCalc\"}}", pid);
+  std::vector<TimelineBuffer *>::iterator B;
+  for (B = buffers.begin(); B != buffers.end(); B++){
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\",\"dropped_spans\":%llu}}", pid, (*B)->tid, (*B)->name.c_str(), (*B)->dropped);
+    std::vector<TimelineEntry>::iterator E;
+    for (E = (*B)->spans.begin(); E != (*B)->spans.end(); E++){
+      fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f", E->name, pid, (*B)->tid, (E->start - startTime) / 1000.0, (E->end - E->start) / 1000.0);
+      if (E->argName){fprintf(out, ",\"args\":{\"%s\":%llu}", E->argName, E->arg);}
+      fprintf(out, "}");
+    }
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  return true;
+}
@@ -0,0 +1,43 @@
+/// \file petritimeline.h
+/// \brief PetriCalc phase timeline header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <string>
+
+/// True while spans are being recorded. Only read directly through TIMELINE_ON, set through timelineConfigure.
+extern volatile bool petriTimelineOn;
+
+/// \brief True if spans are being recorded. A single byte load, so costs one well-predicted branch when off.
+#define TIMELINE_ON __builtin_expect(petriTimelineOn, 0)
+
+bool timelineConfigure(std::string filename);
+unsigned long long timelineNow();
+void timelineSpan(const char * name, unsigned long long start, unsigned long long end, const char * argName = 0, unsigned long long arg = 0);
+void timelineThreadName(std::string name);
+bool timelineWrite();
+
+/// \brief Records the lifetime of this object as a span on the timeline of the current thread.
+///
+/// Spans shorter than minNs nanoseconds are dropped, so frequently called code only shows up when it stalls.
+/// The name must be a string literal or otherwise live until timelineWrite is called.
+class TimelineSpan{
+  public:
+    /// \brief Starts the span, if the timeline is enabled.
+    inline TimelineSpan(const char * spanName, unsigned long long minNs = 0){
+      name = spanName;
+      minDuration = minNs;
+      start = TIMELINE_ON ? timelineNow() : 0;
+    }
+    /// \brief Ends the span, if it was started.
+    inline ~TimelineSpan(){
+      if (start){
+        unsigned long long end = timelineNow();
+        if (end - start >= minDuration){timelineSpan(name, start, end);}
+      }
+    }
+  private:
+    const char * name; ///< Name of the span.
+    unsigned long long minDuration; ///< Spans shorter than this are dropped.
+    unsigned long long start; ///< Start time, 0 if the timeline was disabled at construction.
+};
@@ -0,0 +1,260 @@
+/// \file petritrace.cpp
+/// \brief PetriCalc runtime trace logging implementation.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+///
+/// Trace records are written in binary form into a lock-free single-producer, single-consumer ring buffer per thread.
+/// A background thread drains all ring buffers and formats the records as text, so tracing threads never wait on I/O.
+/// Only when a ring buffer is full does its thread wait for the formatter to catch up, so no records are lost while tracing runs.
+/// Once traceStop has stopped the formatter, a record that does not fit in the full ring buffer of its thread is dropped.
+
+#include "petritrace.h"
+#include "petristats.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+volatile unsigned char petriTraceLevels[TRACE_CATEGORIES] = {0, 0, 0, 0};
+
+/// Size of each per-thread ring buffer in 64-bit words. Must be a power of two.
+#define TRACE_RING_WORDS 65536
+
+/// Longer strings are cut off at this length.
+#define TRACE_MAX_STRING 256
+
+/// \brief A per-thread ring buffer of binary trace records.
+///
+/// Each record is a header word, a timestamp word, the arguments and the strings.
+/// The header holds the event in bits 0-15, the argument count in bits 16-23, the string count in bits 24-31 and the total record size in words in bits 32-47.
+/// Strings are stored as a length word followed by the characters, padded to whole words.
+struct TraceBuffer{
+  std::atomic<unsigned long long> head; ///< Words ever written, only advanced by the owning thread.
+  std::atomic<unsigned long long> tail; ///< Words ever consumed, only advanced by the formatter thread.
+  unsigned long long words[TRACE_RING_WORDS]; ///< Record storage.
+};
+
+/// \brief Category and level of each event, indexed by event.
+static const unsigned char eventCategory[EV_COUNT][2] = {
+  {TRACE_LOAD, 2}, {TRACE_LOAD, 2}, {TRACE_LOAD, 2}, {TRACE_LOAD, 1}, {TRACE_LOAD, 1},
+  {TRACE_COMBINE, 1}, {TRACE_RANGE, 1},
+  {TRACE_STEP, 2}, {TRACE_STEP, 1}, {TRACE_STEP, 2}, {TRACE_STEP, 1}
+};
+
+/// Command line names of the categories, indexed by category.
+static const char * categoryNames[TRACE_CATEGORIES] = {"load", "combine", "range", "step"};
+
+static std::mutex buffersMutex; ///< Guards buffers.
+static std::vector<TraceBuffer *> buffers; ///< All ring buffers ever created. They are kept until the process exits.
+static thread_local TraceBuffer * myBuffer = 0; ///< Ring buffer of the current thread.
+static std::thread formatter; ///< The formatter thread, if running.
+static std::atomic<bool> formatterRunning(false); ///< Cleared to stop the formatter thread.
+static FILE * traceOut = 0; ///< Formatted output.
+static unsigned long long startTicks = 0; ///< Timestamp when tracing was configured.
+static struct timespec startTime; ///< Wall clock time when tracing was configured.
+
+/// \brief Appends a human readable arc label, as PetriArc::label prints it, from TRACE_ARC_WORDS words.
+static void formatArc(std::stringstream & out, const unsigned long long * w){
+  out << "((" << w[0] << ", " << w[1] << ", ";
+  if (w[2] == 0xFFFFFFFFFFFFFFFFull){
+    out << "Infty";
+  }else{
+    out << w[2];
+  }
+  out << "), (" << (w[4] ? "S" : "") << (long long)w[3] << ", +" << (long long)w[5] << "))";
+}
+
+/// \brief Formats a single record as a line of text.
+static void formatRecord(unsigned int event, unsigned long long ticks, const unsigned long long * a, const std::string * str, double ticksPerSecond){
+  std::stringstream out;
+  char stamp[32];
+  snprintf(stamp, sizeof(stamp), "[%.6f] ", (ticks - startTicks) / ticksPerSecond);
+  out << stamp;
+  switch (event){
+    case EV_ADD_PLACE: out << "Added place " << str[0] << " with " << a[0] << " tokens"; break;
+    case EV_ADD_TRANSITION: out << "Added transition " << str[0]; break;
+    case EV_INSERT_ARC:
+      out << "Inserting arc " << str[0] << "<->" << str[1] << ": ";
+      formatArc(out, a);
+      break;
+    case EV_DEAD_TRANSITION: out << "Removing dead transition " << str[0]; break;
+    case EV_MERGE_TRANSITION: out << "Merging transition " << str[0] << " into identical transition " << str[1]; break;
+    case EV_COMBINE_ARC:
+      out << "Combining arc " << str[0] << "<->" << str[1] << ": (";
+      formatArc(out, a);
+      out << " COMB ";
+      formatArc(out, a + TRACE_ARC_WORDS);
+      out << ") = ";
+      formatArc(out, a + 2 * TRACE_ARC_WORDS);
+      break;
+    case EV_RANGE:
+      out << "Arc ";
+      formatArc(out, a);
+      out << " is " << (a[TRACE_ARC_WORDS + 1] ? "enabled" : "disabled") << " with " << a[TRACE_ARC_WORDS] << " tokens";
+      break;
+    case EV_SINGLE_ENABLED: out << "Single-stepping: " << a[0] << " transitions enabled"; break;
+    case EV_SINGLE_PICKED: out << "Single-stepping: picked transition " << str[0]; break;
+    case EV_MAX_ENABLED: out << "Maximal auto-concurrent stepping: " << a[0] << " transitions enabled"; break;
+    case EV_MAX_PICKED:
+      out << "Maximal auto-concurrent stepping: picked transition " << str[0];
+      if (a[0] > 1){out << " (X" << a[0] << ")";}
+      break;
+    default: out << "Unknown trace event " << event; break;
+  }
+  out << "\n";
+  fputs(out.str().c_str(), traceOut);
+}
+
+/// \brief Formats all pending records of all ring buffers. Returns the amount of records formatted.
+static unsigned long long drainBuffers(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+  double ticksPerSecond = (elapsed > 0.001) ? (PetriStats::ticks() - startTicks) / elapsed : 1e9;
+  std::vector<TraceBuffer *> all;
+  {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    all = buffers;
+  }
+  unsigned long long count = 0;
+  unsigned long long args[256];
+  std::string str[2];
+  for (unsigned int b = 0; b < all.size(); ++b){
+    TraceBuffer * B = all[b];
+    unsigned long long tail = B->tail.load(std::memory_order_relaxed);
+    unsigned long long head = B->head.load(std::memory_order_acquire);
+    while (tail < head){
+      unsigned long long header = B->words[tail & (TRACE_RING_WORDS - 1)];
+      unsigned long long ticks = B->words[(tail + 1) & (TRACE_RING_WORDS - 1)];
+      unsigned int argCount = (header >> 16) & 0xFF;
+      unsigned int strCount = (header >> 24) & 0xFF;
+      unsigned long long pos = tail + 2;
+      for (unsigned int i = 0; i < argCount; ++i){args[i] = B->words[(pos++) & (TRACE_RING_WORDS - 1)];}
+      for (unsigned int i = 0; i < strCount && i < 2; ++i){
+        unsigned long long len = B->words[(pos++) & (TRACE_RING_WORDS - 1)];
+        str[i].resize(len);
+        for (unsigned long long c = 0; c < len; ++c){str[i][c] = (B->words[(pos + c / 8) & (TRACE_RING_WORDS - 1)] >> (8 * (c % 8))) & 0xFF;}
+        pos += (len + 7) / 8;
+      }
+      formatRecord(header & 0xFFFF, ticks, args, str, ticksPerSecond);
+      tail += (header >> 32) & 0xFFFF;
+      count++;
+    }
+    B->tail.store(tail, std::memory_order_release);
+  }
+  if (count){fflush(traceOut);}
+  return count;
+}
+
+/// \brief Main loop of the formatter thread.
+static void formatterLoop(){
+  while (formatterRunning.load(std::memory_order_relaxed)){
+    if (!drainBuffers()){usleep(1000);}
+  }
+}
+
+/// \brief Writes a binary trace record into the ring buffer of the current thread.
+///
+/// Call only when TRACE_ON is true for the event's category and level.
+/// Strings are copied into the record, so they need not outlive the call.
+/// After traceStop, the record is dropped if the ring buffer is full.
+void traceRecord(unsigned int event, unsigned int argCount, const unsigned long long * args, const char * str1, const char * str2){
+  if (!myBuffer){
+    myBuffer = new TraceBuffer;
+    myBuffer->head.store(0);
+    myBuffer->tail.store(0);
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffers.push_back(myBuffer);
+  }
+  const char * strings[2] = {str1, str2};
+  unsigned long long lengths[2] = {0, 0};
+  unsigned int strCount = str2 ? 2 : (str1 ? 1 : 0);
+  unsigned long long need = 2 + argCount;
+  for (unsigned int i = 0; i < strCount; ++i){
+    lengths[i] = strlen(strings[i]);
+    if (lengths[i] > TRACE_MAX_STRING){lengths[i] = TRACE_MAX_STRING;}
+    need += 1 + (lengths[i] + 7) / 8;
+  }
+  unsigned long long head = myBuffer->head.load(std::memory_order_relaxed);
+  //Wait for the formatter if the ring buffer is full
+  while (head + need - myBuffer->tail.load(std::memory_order_acquire) > TRACE_RING_WORDS){
+    //Nobody drains the buffer any more after traceStop, so drop the record rather than wait forever
+    if (!formatterRunning.load(std::memory_order_relaxed)){return;}
+    sched_yield();
+  }
+  myBuffer->words[head & (TRACE_RING_WORDS - 1)] = event | (argCount << 16) | (strCount << 24) | (need << 32);
+  myBuffer->words[(head + 1) & (TRACE_RING_WORDS - 1)] = PetriStats::ticks();
+  unsigned long long pos = head + 2;
+  for (unsigned int i = 0; i < argCount; ++i){myBuffer->words[(pos++) & (TRACE_RING_WORDS - 1)] = args[i];}
+  for (unsigned int i = 0; i < strCount; ++i){
+    myBuffer->words[(pos++) & (TRACE_RING_WORDS - 1)] = lengths[i];
+    for (unsigned long long c = 0; c < lengths[i]; c += 8){
+      unsigned long long w = 0;
+      for (unsigned int b = 0; b < 8 && c + b < lengths[i]; ++b){w |= ((unsigned long long)(unsigned char)strings[i][c + b]) << (8 * b);}
+      myBuffer->words[(pos++) & (TRACE_RING_WORDS - 1)] = w;
+    }
+  }
+  myBuffer->head.store(head + need, std::memory_order_release);
+}
+
+/// \brief Stops the formatter thread after formatting all pending records.
+///
+/// Registered with atexit by traceConfigure, but may be called earlier.
+void traceStop(){
+  if (!formatterRunning.exchange(false)){return;}
+  for (unsigned int c = 0; c < TRACE_CATEGORIES; ++c){petriTraceLevels[c] = 0;}
+  formatter.join();
+  drainBuffers();
+}
+
+/// \brief Sets the trace levels from a specification and starts the formatter thread writing to the given file.
+///
+/// The specification is a comma-separated list of category[:level] entries, with category one of load, combine, range, step or all.
+/// The level defaults to 1 (normal), 2 is detailed.
+/// For compatibility with the old compile-time DEBUG levels, a single number sets the levels those DEBUG levels enabled.
+/// Returns false if the specification is invalid.
+bool traceConfigure(std::string spec, FILE * out){
+  unsigned char levels[TRACE_CATEGORIES] = {0, 0, 0, 0};
+  if (spec.size() && spec.find_first_not_of("0123456789") == std::string::npos){
+    int debug = atoi(spec.c_str());
+    if (debug >= 4){levels[TRACE_STEP] = 1;}
+    if (debug >= 5){levels[TRACE_STEP] = 2;}
+    if (debug >= 8){levels[TRACE_RANGE] = 1;}
+    if (debug >= 9){levels[TRACE_COMBINE] = 1;}
+    if (debug >= 10){levels[TRACE_LOAD] = 2;}
+  }else{
+    std::stringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ',')){
+      unsigned char level = 1;
+      size_t colon = item.find(':');
+      if (colon != std::string::npos){
+        level = atoi(item.substr(colon + 1).c_str());
+        item = item.substr(0, colon);
+      }
+      bool found = false;
+      for (unsigned int c = 0; c < TRACE_CATEGORIES; ++c){
+        if (item == categoryNames[c] || item == "all"){
+          levels[c] = level;
+          found = true;
+        }
+      }
+      if (!found){return false;}
+    }
+  }
+  traceOut = out;
+  startTicks = PetriStats::ticks();
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  bool any = false;
+  for (unsigned int c = 0; c < TRACE_CATEGORIES; ++c){any = any || levels[c];}
+  if (any && !formatterRunning.exchange(true)){
+    formatter = std::thread(formatterLoop);
+    atexit(traceStop);
+  }
+  for (unsigned int c = 0; c < TRACE_CATEGORIES; ++c){petriTraceLevels[c] = levels[c];}
+  return true;
+}
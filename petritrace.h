@@ -0,0 +1,44 @@
+/// \file petritrace.h
+/// \brief PetriCalc runtime trace logging header file.
+/// \copyright This code is public domain - do with it what you want. A mention of the original author would be appreciated though.
+
+#pragma once
+#include <string>
+#include <stdio.h>
+
+//Trace categories. Each has a level: 0 = off, 1 = normal, 2 = detailed.
+#define TRACE_LOAD 0 ///< Net loading: dead and merged transitions (1), every place, transition and arc (2)
+#define TRACE_COMBINE 1 ///< Arc combining during load
+#define TRACE_RANGE 2 ///< Range function evaluations
+#define TRACE_STEP 3 ///< Chosen transitions (1), enabled transition counts (2)
+#define TRACE_CATEGORIES 4 ///< Amount of trace categories
+
+//Trace events. Every event belongs to a single category and level, see the event table in petritrace.cpp.
+//Names are passed as strings, all other arguments as words.
+#define EV_ADD_PLACE 0 ///< Strings: place name. Args: tokens
+#define EV_ADD_TRANSITION 1 ///< Strings: transition name
+#define EV_INSERT_ARC 2 ///< Strings: transition name, place name. Args: arc
+#define EV_DEAD_TRANSITION 3 ///< Strings: transition name
+#define EV_MERGE_TRANSITION 4 ///< Strings: merged transition name, remaining transition name
+#define EV_COMBINE_ARC 5 ///< Strings: transition name, place name. Args: arc, added arc, result arc
+#define EV_RANGE 6 ///< Args: arc, tokens, result
+#define EV_SINGLE_ENABLED 7 ///< Args: enabled count
+#define EV_SINGLE_PICKED 8 ///< Strings: transition name
+#define EV_MAX_ENABLED 9 ///< Args: enabled count
+#define EV_MAX_PICKED 10 ///< Strings: transition name. Args: times picked
+#define EV_COUNT 11 ///< Amount of trace events
+
+/// Words needed to store an arc label in a trace record: used, low, high, effect, setter, added.
+#define TRACE_ARC_WORDS 6
+
+/// Per-category trace levels. Only read directly through TRACE_ON, set through traceConfigure.
+extern volatile unsigned char petriTraceLevels[TRACE_CATEGORIES];
+
+/// \brief True if events of the given category and level are traced.
+///
+/// This is a single byte load and compare, so with tracing disabled the hot path only pays one well-predicted branch.
+#define TRACE_ON(category, level) __builtin_expect(petriTraceLevels[category] >= (level), 0)
+
+bool traceConfigure(std::string spec, FILE * out);
+void traceRecord(unsigned int event, unsigned int argCount, const unsigned long long * args, const char * str1 = 0, const char * str2 = 0);
+void traceStop();